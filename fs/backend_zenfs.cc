@@ -0,0 +1,129 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "backend_zenfs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "filezbd_zenfs.h"
+#include "latency_zenfs.h"
+#include "memzbd_zenfs.h"
+#include "zbdlib_zenfs.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+static bool ParseSize(const std::string &str, uint64_t *size) {
+  char *end;
+  uint64_t val = strtoull(str.c_str(), &end, 10);
+
+  if (end == str.c_str()) return false;
+  switch (*end) {
+    case 'G':
+    case 'g':
+      val <<= 10;
+      // fall through
+    case 'M':
+    case 'm':
+      val <<= 10;
+      // fall through
+    case 'K':
+    case 'k':
+      val <<= 10;
+      end++;
+      break;
+    default:
+      break;
+  }
+  if (*end != '\0') return false;
+
+  *size = val;
+  return true;
+}
+
+IOStatus ParseEmulatedZoneOptions(const std::string &spec,
+                                  EmulatedZoneOptions *options) {
+  std::stringstream ss(spec);
+  std::string option;
+
+  while (std::getline(ss, option, ',')) {
+    if (option.empty()) continue;
+
+    size_t eq = option.find('=');
+    uint64_t val;
+    if (eq == std::string::npos || !ParseSize(option.substr(eq + 1), &val))
+      return IOStatus::InvalidArgument("Malformed zone option: " + option);
+
+    std::string key = option.substr(0, eq);
+    if (key == "block_size") {
+      options->block_size = val;
+    } else if (key == "zone_size") {
+      options->zone_size = val;
+    } else if (key == "zone_capacity") {
+      options->zone_capacity = val;
+    } else if (key == "nr_zones") {
+      options->nr_zones = val;
+    } else if (key == "max_active_zones") {
+      options->max_active_zones = val;
+    } else if (key == "max_open_zones") {
+      options->max_open_zones = val;
+    } else {
+      return IOStatus::InvalidArgument("Unknown zone option: " + key);
+    }
+  }
+  return IOStatus::OK();
+}
+
+std::unique_ptr<ZonedBlockDeviceBackend> NewZonedBlockDeviceBackend(
+    const std::string &bdevname) {
+  bool is_file = bdevname.rfind("file:", 0) == 0;
+  bool is_mem = bdevname.rfind("mem:", 0) == 0;
+
+  if (!is_file && !is_mem)
+    return std::unique_ptr<ZonedBlockDeviceBackend>(
+        new ZbdlibBackend(bdevname));
+
+  std::string name = bdevname.substr(bdevname.find(':') + 1);
+  std::string options;
+  size_t comma = name.find(',');
+  if (comma != std::string::npos) {
+    options = name.substr(comma + 1);
+    name.erase(comma);
+  }
+
+  /* The latency profile is not a zone option, take it out */
+  std::string profile;
+  std::stringstream ss(options);
+  std::string option;
+  options.clear();
+  while (std::getline(ss, option, ',')) {
+    if (option.rfind("latency_profile=", 0) == 0)
+      profile = option.substr(strlen("latency_profile="));
+    else
+      options += option + ",";
+  }
+
+  std::unique_ptr<ZonedBlockDeviceBackend> backend;
+  if (is_file)
+    backend.reset(new FileZonedBackend(name, options));
+  else
+    backend.reset(new MemZonedBackend(name, options));
+
+  if (!profile.empty())
+    backend.reset(new LatencyModelBackend(std::move(backend), profile));
+  return backend;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
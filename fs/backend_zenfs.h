@@ -0,0 +1,106 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* State of a zone as reported by the device */
+struct ZoneInfo {
+  uint64_t start = 0;
+  /* Writable capacity of the zone when empty */
+  uint64_t capacity = 0;
+  uint64_t wp = 0;
+  bool seq_write_required = true;
+  bool offline = false;
+  bool full = false;
+  bool readonly = false;
+  bool open = false;
+  bool closed = false;
+};
+
+/* Zone management and IO of a zoned block device
+ *
+ * ZonedBlockDevice keeps track of zones and allocates them, the backend only
+ * carries out the zone operations and the reads and writes. Read and Write
+ * behave like pread and pwrite, returning the number of bytes transferred or
+ * -1 with errno set.
+ */
+class ZonedBlockDeviceBackend {
+ protected:
+  uint32_t block_sz_ = 0;
+  uint64_t zone_sz_ = 0;
+  uint32_t nr_zones_ = 0;
+  /* 0 if the device has no limit */
+  uint32_t max_active_zones_ = 0;
+  uint32_t max_open_zones_ = 0;
+
+ public:
+  virtual ~ZonedBlockDeviceBackend() {}
+
+  /* Opens the device and sets the device geometry */
+  virtual IOStatus Open(bool readonly, bool exclusive) = 0;
+  virtual IOStatus ListZones(std::vector<ZoneInfo> *zones) = 0;
+  /* Reports the state of nr_zones zones from start on, in one request */
+  virtual IOStatus ReportZones(uint64_t start, uint32_t nr_zones,
+                               std::vector<ZoneInfo> *zones) = 0;
+  /* Resets nr_zones contiguous zones from start on, in one request */
+  virtual IOStatus Reset(uint64_t start, uint32_t nr_zones) = 0;
+  virtual IOStatus Finish(uint64_t start) = 0;
+  virtual IOStatus Close(uint64_t start) = 0;
+  virtual int Read(char *buf, int size, uint64_t pos, bool direct) = 0;
+  virtual int Write(const char *data, uint32_t size, uint64_t pos) = 0;
+  /* Identifies the device in file unique ids */
+  virtual bool GetDeviceId(uint64_t *dev, uint64_t *ino) = 0;
+  virtual std::string GetFilename() = 0;
+
+  uint32_t GetBlockSize() { return block_sz_; }
+  uint64_t GetZoneSize() { return zone_sz_; }
+  uint32_t GetNrZones() { return nr_zones_; }
+  uint32_t GetMaxActiveZones() { return max_active_zones_; }
+  uint32_t GetMaxOpenZones() { return max_open_zones_; }
+};
+
+/* Geometry and limits of an emulated zoned device */
+struct EmulatedZoneOptions {
+  uint32_t block_size = 4096;
+  uint64_t zone_size = 64ULL << 20;
+  /* Writable bytes per zone, zone_size if 0 */
+  uint64_t zone_capacity = 0;
+  uint32_t nr_zones = 64;
+  /* 0 for no limit */
+  uint32_t max_active_zones = 0;
+  uint32_t max_open_zones = 0;
+};
+
+/* Parse a comma separated list like zone_size=256M,nr_zones=128. Sizes take
+ * K, M and G suffixes. */
+IOStatus ParseEmulatedZoneOptions(const std::string &spec,
+                                  EmulatedZoneOptions *options);
+
+/* Create the backend for a device name:
+ *   <name>                 zoned block device /dev/<name>, through libzbd
+ *   file:<path>[,options]  zones emulated in a regular file
+ *   mem:<name>[,options]   zones emulated in memory, for the lifetime of the
+ *                          process
+ * The options are the emulated geometry, see ParseEmulatedZoneOptions, and
+ * latency_profile=<file> to add a LatencyModelBackend with the profile in
+ * the file. Malformed options fail the Open of the backend. */
+std::unique_ptr<ZonedBlockDeviceBackend> NewZonedBlockDeviceBackend(
+    const std::string &bdevname);
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,137 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "bufpool_zenfs.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+namespace ROCKSDB_NAMESPACE {
+
+WriteBufferPool::WriteBufferPool(const WriteBufferPoolOptions &options)
+    : options_(options) {}
+
+WriteBufferPool::~WriteBufferPool() {
+  assert(in_use_ == 0);
+  for (uint32_t c = 0; c < WRITE_BUFFER_NR_CLASSES; c++) {
+    for (char *buf : free_[c]) {
+      if (!IsHugePage(buf)) free(buf);
+    }
+  }
+  for (char *chunk : huge_chunks_) munmap(chunk, HUGE_PAGE_SIZE);
+}
+
+void WriteBufferPool::SetOptions(const WriteBufferPoolOptions &options) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    options_ = options;
+  }
+  returned_cv_.notify_all();
+}
+
+size_t WriteBufferPool::SizeClass(size_t size) {
+  size_t class_size = WRITE_BUFFER_MIN_SIZE;
+  while (class_size < size && class_size < WRITE_BUFFER_MAX_SIZE)
+    class_size <<= 1;
+  return class_size;
+}
+
+uint32_t WriteBufferPool::ClassIndex(size_t size) {
+  uint32_t c = 0;
+  while ((size_t)WRITE_BUFFER_MIN_SIZE << c < size) c++;
+  assert(c < WRITE_BUFFER_NR_CLASSES);
+  return c;
+}
+
+bool WriteBufferPool::IsHugePage(char *buf) {
+  for (char *chunk : huge_chunks_) {
+    if (buf >= chunk && buf < chunk + HUGE_PAGE_SIZE) return true;
+  }
+  return false;
+}
+
+/* Must hold mtx_ */
+char *WriteBufferPool::Allocate(size_t size) {
+  if (options_.use_huge_pages) {
+    if (huge_left_ < size) {
+      void *chunk = mmap(nullptr, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (chunk == MAP_FAILED) {
+        /* No huge pages reserved, don't try again */
+        options_.use_huge_pages = false;
+      } else {
+        /* The rest of the previous chunk is left unused */
+        huge_chunks_.push_back((char *)chunk);
+        huge_free_ = (char *)chunk;
+        huge_left_ = HUGE_PAGE_SIZE;
+      }
+    }
+    if (huge_left_ >= size) {
+      char *buf = huge_free_;
+      huge_free_ += size;
+      huge_left_ -= size;
+      return buf;
+    }
+  }
+
+  char *buf;
+  if (posix_memalign((void **)&buf, sysconf(_SC_PAGESIZE), size))
+    return nullptr;
+  return buf;
+}
+
+char *WriteBufferPool::Get(size_t size) {
+  uint32_t c = ClassIndex(size);
+  std::unique_lock<std::mutex> lock(mtx_);
+
+  if (in_use_ > 0 && in_use_ + size > options_.capacity) {
+    auto deadline = std::chrono::steady_clock::now() + options_.max_wait;
+    returned_cv_.wait_until(lock, deadline, [&] {
+      return in_use_ == 0 || in_use_ + size <= options_.capacity;
+    });
+  }
+
+  char *buf = nullptr;
+  if (!free_[c].empty()) {
+    buf = free_[c].back();
+    free_[c].pop_back();
+    cached_ -= size;
+  } else {
+    buf = Allocate(size);
+    if (buf == nullptr) return nullptr;
+  }
+
+  in_use_ += size;
+  return buf;
+}
+
+void WriteBufferPool::Put(char *buf, size_t size) {
+  uint32_t c = ClassIndex(size);
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    assert(in_use_ >= size);
+    in_use_ -= size;
+
+    /* Huge page buffers can't be freed one by one */
+    if (cached_ + size <= options_.max_cached || IsHugePage(buf)) {
+      free_[c].push_back(buf);
+      cached_ += size;
+    } else {
+      free(buf);
+    }
+  }
+  returned_cv_.notify_all();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,79 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Write buffers come in power of two size classes between these sizes */
+#define WRITE_BUFFER_MIN_SIZE (64 << 10)
+#define WRITE_BUFFER_MAX_SIZE (1 << 20)
+#define WRITE_BUFFER_NR_CLASSES (5)
+
+struct WriteBufferPoolOptions {
+  /* Memory of the buffers handed out. A request beyond it waits for buffers
+   * to be returned for up to max_wait, and is then served anyway, so a
+   * writer holding on to a buffer can't block the others for good. */
+  size_t capacity = 256 << 20;
+  std::chrono::milliseconds max_wait{100};
+  /* Memory of the returned buffers kept for reuse */
+  size_t max_cached = 64 << 20;
+  /* Carve the buffers out of 2 MB huge pages. Huge page memory is kept for
+   * reuse until the pool is destroyed. Falls back to regular pages when no
+   * huge pages are available. */
+  bool use_huge_pages = false;
+};
+
+/* Page aligned buffers for buffered writes, shared by all files
+ *
+ * Files only hold a buffer while it has data that is not synced yet, and
+ * size it to the amount of data they write between syncs.
+ */
+class WriteBufferPool {
+ private:
+  std::mutex mtx_;
+  std::condition_variable returned_cv_;
+  WriteBufferPoolOptions options_;
+  std::vector<char *> free_[WRITE_BUFFER_NR_CLASSES];
+  size_t in_use_ = 0;
+  size_t cached_ = 0;
+
+  /* Huge page chunks and the part of the last one not carved up yet */
+  std::vector<char *> huge_chunks_;
+  char *huge_free_ = nullptr;
+  size_t huge_left_ = 0;
+
+  static uint32_t ClassIndex(size_t size);
+  bool IsHugePage(char *buf);
+  char *Allocate(size_t size);
+
+ public:
+  explicit WriteBufferPool(
+      const WriteBufferPoolOptions &options = WriteBufferPoolOptions());
+  ~WriteBufferPool();
+
+  void SetOptions(const WriteBufferPoolOptions &options);
+
+  /* The smallest size class of at least size bytes, capped at the largest
+   * class */
+  static size_t SizeClass(size_t size);
+
+  /* Get a buffer of a size class, nullptr if out of memory */
+  char *Get(size_t size);
+  void Put(char *buf, size_t size);
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
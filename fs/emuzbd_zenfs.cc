@@ -0,0 +1,216 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "emuzbd_zenfs.h"
+
+#include <errno.h>
+
+#include <string>
+
+namespace ROCKSDB_NAMESPACE {
+
+IOStatus EmulatedZonedBackend::InitZones() {
+  if (!options_status_.ok()) return options_status_;
+
+  uint64_t capacity = options_.zone_capacity;
+  if (capacity == 0) capacity = options_.zone_size;
+
+  std::vector<EmulatedZone> zones(options_.nr_zones);
+  for (uint32_t i = 0; i < options_.nr_zones; i++) {
+    zones[i].wp = i * options_.zone_size;
+    zones[i].capacity = capacity;
+    zones[i].open = false;
+    zones[i].full = false;
+  }
+  return InitZones(zones);
+}
+
+IOStatus EmulatedZonedBackend::InitZones(
+    const std::vector<EmulatedZone> &zones) {
+  if (!options_status_.ok()) return options_status_;
+
+  uint64_t capacity = options_.zone_capacity;
+  if (capacity == 0) capacity = options_.zone_size;
+
+  if (options_.block_size == 0 || options_.zone_size == 0 ||
+      options_.zone_size % options_.block_size)
+    return IOStatus::InvalidArgument("Invalid emulated zone geometry");
+  if (capacity > options_.zone_size || capacity % options_.block_size)
+    return IOStatus::InvalidArgument("Invalid emulated zone capacity");
+  if (zones.size() != options_.nr_zones)
+    return IOStatus::Corruption("Emulated zone count mismatch");
+
+  block_sz_ = options_.block_size;
+  zone_sz_ = options_.zone_size;
+  nr_zones_ = options_.nr_zones;
+  max_active_zones_ = options_.max_active_zones;
+  max_open_zones_ = options_.max_open_zones;
+
+  zones_ = zones;
+  nr_active_ = 0;
+  for (uint32_t i = 0; i < nr_zones_; i++) {
+    /* Open zones do not survive a restart of the device */
+    zones_[i].open = false;
+    if (IsActive(i)) nr_active_++;
+  }
+
+  return IOStatus::OK();
+}
+
+IOStatus EmulatedZonedBackend::GetZoneIndex(uint64_t start, uint32_t *idx) {
+  if (start % zone_sz_ || start / zone_sz_ >= nr_zones_)
+    return IOStatus::InvalidArgument("Not a zone start");
+  *idx = start / zone_sz_;
+  return IOStatus::OK();
+}
+
+void EmulatedZonedBackend::FillZoneInfo(uint32_t idx, ZoneInfo *info) {
+  const EmulatedZone &z = zones_[idx];
+
+  info->start = ZoneStart(idx);
+  info->capacity = z.capacity;
+  info->wp = z.full ? info->start + zone_sz_ : z.wp;
+  info->full = z.full;
+  info->open = z.open;
+  info->closed = IsActive(idx) && !z.open;
+}
+
+IOStatus EmulatedZonedBackend::ListZones(std::vector<ZoneInfo> *zones) {
+  return ReportZones(0, nr_zones_, zones);
+}
+
+IOStatus EmulatedZonedBackend::ReportZones(uint64_t start, uint32_t nr_zones,
+                                           std::vector<ZoneInfo> *zones) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint32_t idx;
+
+  IOStatus s = GetZoneIndex(start, &idx);
+  if (!s.ok()) return s;
+  if (nr_zones > nr_zones_ - idx)
+    return IOStatus::InvalidArgument("Zone report beyond the device end");
+
+  zones->clear();
+  zones->resize(nr_zones);
+  for (uint32_t i = 0; i < nr_zones; i++) FillZoneInfo(idx + i, &(*zones)[i]);
+
+  return IOStatus::OK();
+}
+
+IOStatus EmulatedZonedBackend::Reset(uint64_t start, uint32_t nr_zones) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint32_t idx;
+
+  IOStatus s = GetZoneIndex(start, &idx);
+  if (!s.ok()) return s;
+  if (nr_zones > nr_zones_ - idx)
+    return IOStatus::InvalidArgument("Zone reset beyond the device end");
+
+  for (uint32_t i = idx; i < idx + nr_zones; i++) {
+    s = DiscardZone(i);
+    if (!s.ok()) return s;
+
+    EmulatedZone &z = zones_[i];
+    if (IsActive(i)) nr_active_--;
+    z.wp = ZoneStart(i);
+    z.open = false;
+    z.full = false;
+    s = ZoneChanged(i);
+    if (!s.ok()) return s;
+    resets_++;
+  }
+
+  return IOStatus::OK();
+}
+
+IOStatus EmulatedZonedBackend::Finish(uint64_t start) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint32_t idx;
+
+  IOStatus s = GetZoneIndex(start, &idx);
+  if (!s.ok()) return s;
+
+  EmulatedZone &z = zones_[idx];
+  if (IsActive(idx)) nr_active_--;
+  z.open = false;
+  z.full = true;
+  s = ZoneChanged(idx);
+  if (!s.ok()) return s;
+  finishes_++;
+
+  return IOStatus::OK();
+}
+
+IOStatus EmulatedZonedBackend::Close(uint64_t start) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint32_t idx;
+
+  IOStatus s = GetZoneIndex(start, &idx);
+  if (!s.ok()) return s;
+
+  zones_[idx].open = false;
+  return IOStatus::OK();
+}
+
+int EmulatedZonedBackend::Read(char *buf, int size, uint64_t pos,
+                               bool /*direct*/) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint64_t dev_sz = (uint64_t)nr_zones_ * zone_sz_;
+
+  if (pos >= dev_sz) return 0;
+  if (pos + size > dev_sz) size = dev_sz - pos;
+
+  return ReadData(buf, size, pos);
+}
+
+int EmulatedZonedBackend::Write(const char *data, uint32_t size,
+                                uint64_t pos) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  uint32_t idx = pos / zone_sz_;
+
+  if (idx >= nr_zones_ || size % block_sz_) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  EmulatedZone &z = zones_[idx];
+  uint64_t start = ZoneStart(idx);
+  if (z.full || pos != z.wp || pos + size > start + z.capacity) {
+    errno = EIO;
+    return -1;
+  }
+
+  bool was_active = IsActive(idx);
+  if (!was_active && max_active_zones_ && nr_active_ >= max_active_zones_) {
+    errno = EIO;
+    return -1;
+  }
+
+  int ret = WriteData(data, size, pos);
+  if (ret <= 0) return ret;
+
+  if (!was_active) nr_active_++;
+  z.wp += ret;
+  z.open = true;
+  if (z.wp == start + z.capacity) {
+    z.open = false;
+    z.full = true;
+    nr_active_--;
+  }
+  /* The data is written, but the write pointer would be lost on restart */
+  if (!ZoneChanged(idx).ok()) {
+    errno = EIO;
+    return -1;
+  }
+  bytes_written_ += ret;
+
+  return ret;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
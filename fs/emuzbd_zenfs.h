@@ -0,0 +1,96 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "backend_zenfs.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Zoned block device emulated on top of some other storage
+ *
+ * Keeps the write pointer and the condition of each zone, and enforces
+ * sequential writes and the active zone limit like a zoned device would.
+ * Like on a real device, going over the open zone limit is not an error.
+ * Subclasses store the zone data.
+ */
+class EmulatedZonedBackend : public ZonedBlockDeviceBackend {
+ public:
+  struct EmulatedZone {
+    uint64_t wp;
+    uint64_t capacity;
+    bool open;
+    bool full;
+  };
+
+ protected:
+  EmulatedZoneOptions options_;
+  IOStatus options_status_;
+  std::mutex zone_mtx_;
+  std::vector<EmulatedZone> zones_;
+  uint32_t nr_active_ = 0;
+
+  std::atomic<uint64_t> bytes_written_{0};
+  std::atomic<uint64_t> resets_{0};
+  std::atomic<uint64_t> finishes_{0};
+
+  uint64_t ZoneStart(uint32_t idx) { return idx * zone_sz_; }
+  bool IsActive(uint32_t idx) {
+    return zones_[idx].wp > ZoneStart(idx) && !zones_[idx].full;
+  }
+
+  /* Set the geometry from options_ and create empty zones */
+  IOStatus InitZones();
+  /* Set the geometry from options_ and take over the zone state */
+  IOStatus InitZones(const std::vector<EmulatedZone> &zones);
+
+  /* Data access, called with zone_mtx_ held. Read returns the number of
+   * bytes read, or -1 with errno set. */
+  virtual int ReadData(char *buf, int size, uint64_t pos) = 0;
+  virtual int WriteData(const char *data, uint32_t size, uint64_t pos) = 0;
+  /* Drop the data of a zone that is being reset */
+  virtual IOStatus DiscardZone(uint32_t idx) = 0;
+  /* Called with zone_mtx_ held when the write pointer or the condition of a
+   * zone changed. A failure fails the zone operation. */
+  virtual IOStatus ZoneChanged(uint32_t /*idx*/) { return IOStatus::OK(); }
+
+ private:
+  IOStatus GetZoneIndex(uint64_t start, uint32_t *idx);
+  void FillZoneInfo(uint32_t idx, ZoneInfo *info);
+
+ public:
+  explicit EmulatedZonedBackend(const EmulatedZoneOptions &options)
+      : options_(options) {}
+  /* Options as parsed by ParseEmulatedZoneOptions */
+  explicit EmulatedZonedBackend(const std::string &options)
+      : options_status_(ParseEmulatedZoneOptions(options, &options_)) {}
+  virtual ~EmulatedZonedBackend() {}
+
+  IOStatus ListZones(std::vector<ZoneInfo> *zones) override;
+  IOStatus ReportZones(uint64_t start, uint32_t nr_zones,
+                       std::vector<ZoneInfo> *zones) override;
+  IOStatus Reset(uint64_t start, uint32_t nr_zones) override;
+  IOStatus Finish(uint64_t start) override;
+  IOStatus Close(uint64_t start) override;
+  int Read(char *buf, int size, uint64_t pos, bool direct) override;
+  int Write(const char *data, uint32_t size, uint64_t pos) override;
+
+  uint64_t GetBytesWritten() { return bytes_written_; }
+  uint64_t GetResets() { return resets_; }
+  uint64_t GetFinishes() { return finishes_; }
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
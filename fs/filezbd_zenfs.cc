@@ -0,0 +1,194 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "filezbd_zenfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "util/coding.h"
+
+/* Layout of the zones file: a header with the geometry, followed by the
+ * write pointer and the condition of each zone */
+#define ZONES_FILE_MAGIC 0x5a454d55 /* "ZEMU" */
+#define ZONES_FILE_VERSION 1
+#define ZONES_FILE_HEADER_SZ 64
+#define ZONES_FILE_ENTRY_SZ 16
+#define ZONES_FILE_ZONE_FULL (1 << 0)
+
+namespace ROCKSDB_NAMESPACE {
+
+FileZonedBackend::FileZonedBackend(const std::string &filename,
+                                   const std::string &options)
+    : EmulatedZonedBackend(options),
+      filename_(filename),
+      data_f_(-1),
+      zones_f_(-1) {}
+
+FileZonedBackend::~FileZonedBackend() {
+  if (data_f_ >= 0) close(data_f_);
+  if (zones_f_ >= 0) close(zones_f_);
+}
+
+IOStatus FileZonedBackend::CreateZonesFile() {
+  std::string buf(ZONES_FILE_HEADER_SZ, '\0');
+  char *header = &buf[0];
+
+  EncodeFixed32(header, ZONES_FILE_MAGIC);
+  EncodeFixed32(header + 4, ZONES_FILE_VERSION);
+  EncodeFixed32(header + 8, options_.block_size);
+  EncodeFixed32(header + 12, options_.nr_zones);
+  EncodeFixed64(header + 16, options_.zone_size);
+  EncodeFixed64(header + 24, options_.zone_capacity);
+  EncodeFixed32(header + 32, options_.max_active_zones);
+  EncodeFixed32(header + 36, options_.max_open_zones);
+
+  if (pwrite(zones_f_, buf.data(), buf.size(), 0) != (ssize_t)buf.size())
+    return IOStatus::IOError("Failed to write zones file header",
+                             strerror(errno));
+  for (uint32_t i = 0; i < nr_zones_; i++) {
+    IOStatus s = ZoneChanged(i);
+    if (!s.ok()) return s;
+  }
+  if (fsync(zones_f_))
+    return IOStatus::IOError("Failed to sync zones file", strerror(errno));
+
+  return IOStatus::OK();
+}
+
+IOStatus FileZonedBackend::LoadZonesFile(std::vector<EmulatedZone> *zones) {
+  char header[ZONES_FILE_HEADER_SZ];
+
+  if (pread(zones_f_, header, sizeof(header), 0) != sizeof(header))
+    return IOStatus::Corruption("Truncated zones file header");
+  if (DecodeFixed32(header) != ZONES_FILE_MAGIC ||
+      DecodeFixed32(header + 4) != ZONES_FILE_VERSION)
+    return IOStatus::Corruption("Not a zones file: " + ZonesFilename());
+
+  options_.block_size = DecodeFixed32(header + 8);
+  options_.nr_zones = DecodeFixed32(header + 12);
+  options_.zone_size = DecodeFixed64(header + 16);
+  options_.zone_capacity = DecodeFixed64(header + 24);
+  options_.max_active_zones = DecodeFixed32(header + 32);
+  options_.max_open_zones = DecodeFixed32(header + 36);
+
+  uint64_t capacity = options_.zone_capacity;
+  if (capacity == 0) capacity = options_.zone_size;
+
+  std::string entries((uint64_t)options_.nr_zones * ZONES_FILE_ENTRY_SZ, '\0');
+  if (pread(zones_f_, &entries[0], entries.size(), ZONES_FILE_HEADER_SZ) !=
+      (ssize_t)entries.size())
+    return IOStatus::Corruption("Truncated zones file");
+
+  zones->resize(options_.nr_zones);
+  for (uint32_t i = 0; i < options_.nr_zones; i++) {
+    const char *entry = entries.data() + i * ZONES_FILE_ENTRY_SZ;
+    EmulatedZone &z = (*zones)[i];
+    z.wp = DecodeFixed64(entry);
+    z.capacity = capacity;
+    z.open = false;
+    z.full = DecodeFixed32(entry + 8) & ZONES_FILE_ZONE_FULL;
+  }
+
+  return IOStatus::OK();
+}
+
+IOStatus FileZonedBackend::Open(bool readonly, bool exclusive) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+  int flags = readonly ? O_RDONLY : O_RDWR;
+  bool create = false;
+  IOStatus s;
+
+  zones_f_ = open(ZonesFilename().c_str(), flags);
+  if (zones_f_ < 0) {
+    if (errno != ENOENT || readonly)
+      return IOStatus::IOError("Failed to open zones file " + ZonesFilename(),
+                               strerror(errno));
+    zones_f_ = open(ZonesFilename().c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (zones_f_ < 0)
+      return IOStatus::IOError("Failed to create zones file " +
+                                   ZonesFilename(),
+                               strerror(errno));
+    create = true;
+  }
+
+  if (exclusive && flock(zones_f_, LOCK_EX | LOCK_NB))
+    return IOStatus::Busy("Emulated device in use: " + filename_);
+
+  data_f_ = open(filename_.c_str(), create ? (flags | O_CREAT) : flags, 0644);
+  if (data_f_ < 0)
+    return IOStatus::IOError("Failed to open " + filename_, strerror(errno));
+
+  if (create) {
+    s = InitZones();
+    if (!s.ok()) return s;
+    if (ftruncate(data_f_, (uint64_t)nr_zones_ * zone_sz_))
+      return IOStatus::IOError("Failed to size " + filename_, strerror(errno));
+    return CreateZonesFile();
+  }
+
+  std::vector<EmulatedZone> zones;
+  s = LoadZonesFile(&zones);
+  if (!s.ok()) return s;
+  return InitZones(zones);
+}
+
+IOStatus FileZonedBackend::ZoneChanged(uint32_t idx) {
+  char entry[ZONES_FILE_ENTRY_SZ] = {0};
+
+  EncodeFixed64(entry, zones_[idx].wp);
+  EncodeFixed32(entry + 8, zones_[idx].full ? ZONES_FILE_ZONE_FULL : 0);
+
+  /* Not synced, like a write pointer is only persistent after a flush */
+  if (pwrite(zones_f_, entry, sizeof(entry),
+             ZONES_FILE_HEADER_SZ + (uint64_t)idx * ZONES_FILE_ENTRY_SZ) !=
+      sizeof(entry))
+    return IOStatus::IOError("Failed to update zones file " + ZonesFilename(),
+                             strerror(errno));
+
+  return IOStatus::OK();
+}
+
+int FileZonedBackend::ReadData(char *buf, int size, uint64_t pos) {
+  return pread(data_f_, buf, size, pos);
+}
+
+int FileZonedBackend::WriteData(const char *data, uint32_t size,
+                                uint64_t pos) {
+  return pwrite(data_f_, data, size, pos);
+}
+
+IOStatus FileZonedBackend::DiscardZone(uint32_t idx) {
+  /* Free the space of the zone, file systems without hole punching keep the
+   * old data around which ZenFS never reads */
+  if (fallocate(data_f_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                ZoneStart(idx), zone_sz_) &&
+      errno != EOPNOTSUPP)
+    return IOStatus::IOError("Zone reset failed", strerror(errno));
+
+  return IOStatus::OK();
+}
+
+bool FileZonedBackend::GetDeviceId(uint64_t *dev, uint64_t *ino) {
+  struct stat buf;
+
+  if (fstat(data_f_, &buf) == -1) return false;
+  *dev = buf.st_dev;
+  *ino = buf.st_ino;
+  return true;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
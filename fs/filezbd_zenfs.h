@@ -0,0 +1,54 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <string>
+#include <vector>
+
+#include "emuzbd_zenfs.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Zoned block device emulated in a regular file
+ *
+ * Zone data is stored at its device offset in the file, and reset zones are
+ * punched out of it. The geometry and the write pointers are kept in a
+ * <file>.zones sidecar file, so the device survives a restart. The geometry
+ * options only apply when the device is created.
+ */
+class FileZonedBackend : public EmulatedZonedBackend {
+ private:
+  std::string filename_;
+  int data_f_;
+  int zones_f_;
+
+  std::string ZonesFilename() { return filename_ + ".zones"; }
+  IOStatus CreateZonesFile();
+  IOStatus LoadZonesFile(std::vector<EmulatedZone> *zones);
+
+ protected:
+  int ReadData(char *buf, int size, uint64_t pos) override;
+  int WriteData(const char *data, uint32_t size, uint64_t pos) override;
+  IOStatus DiscardZone(uint32_t idx) override;
+  IOStatus ZoneChanged(uint32_t idx) override;
+
+ public:
+  /* See ParseEmulatedZoneOptions for the options */
+  FileZonedBackend(const std::string &filename, const std::string &options);
+  ~FileZonedBackend();
+
+  IOStatus Open(bool readonly, bool exclusive) override;
+  bool GetDeviceId(uint64_t *dev, uint64_t *ino) override;
+  std::string GetFilename() override { return filename_; }
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
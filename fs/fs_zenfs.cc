@@ -15,7 +15,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -161,7 +164,7 @@ IOStatus ZenMetaLog::AddRecord(const Slice& slice) {
 }
 
 IOStatus ZenMetaLog::Read(Slice* slice) {
-  int f = zbd_->GetReadFD();
+  ZonedBlockDeviceBackend* zbd_be = zbd_->GetBackend();
   const char* data = slice->data();
   size_t read = 0;
   size_t to_read = slice->size();
@@ -178,7 +181,7 @@ IOStatus ZenMetaLog::Read(Slice* slice) {
   }
 
   while (read < to_read) {
-    ret = pread(f, (void*)(data + read), to_read - read, read_pos_);
+    ret = zbd_be->Read((char*)(data + read), to_read - read, read_pos_, false);
 
     if (ret == -1 && errno == EINTR) continue;
     if (ret < 0) return IOStatus::IOError("Read failed");
@@ -250,6 +253,7 @@ ZenFS::ZenFS(ZonedBlockDevice* zbd, std::shared_ptr<FileSystem> aux_fs,
 ZenFS::~ZenFS() {
   Status s;
   Info(logger_, "ZenFS shutting down");
+  zbd_->StopBackgroundWork();
   zbd_->LogZoneUsage();
   LogFiles();
 
@@ -283,19 +287,18 @@ void ZenFS::LogFiles() {
   Info(logger_, "  Files:\n");
   for (it = files_.begin(); it != files_.end(); it++) {
     std::shared_ptr<ZoneFile> zFile = it->second;
-    std::vector<ZoneExtent*> extents = zFile->GetExtents();
+    std::vector<ZoneExtent> extents = zFile->GetExtents();
 
     Info(logger_, "    %-45s sz: %lu lh: %d sparse: %u", it->first.c_str(),
          zFile->GetFileSize(), zFile->GetWriteLifeTimeHint(),
          zFile->IsSparse());
     for (unsigned int i = 0; i < extents.size(); i++) {
-      ZoneExtent* extent = extents[i];
-      Info(logger_, "          Extent %u {start=0x%lx, zone=%u, len=%lu} ", i,
-           extent->start_,
-           (uint32_t)(extent->zone_->start_ / zbd_->GetZoneSize()),
-           extent->length_);
+      const ZoneExtent& extent = extents[i];
+      Info(logger_, "          Extent %u {start=0x%lx, zone=%u, len=%u} ", i,
+           extent.start_, (uint32_t)(extent.start_ / zbd_->GetZoneSize()),
+           extent.length_);
 
-      total_size += extent->length_;
+      total_size += extent.length_;
     }
   }
   Info(logger_, "Sum of all files: %lu MB of data \n",
@@ -317,10 +320,21 @@ IOStatus ZenFS::WriteSnapshotLocked(ZenMetaLog* meta_log) {
   EncodeSnapshotTo(&snapshot);
   s = meta_log->AddRecord(snapshot);
   if (s.ok()) {
+    size_t file_memory = 0;
     for (auto it = files_.begin(); it != files_.end(); it++) {
       std::shared_ptr<ZoneFile> zoneFile = it->second;
       zoneFile->MetadataSynced();
+      /* Files are listed once per link. Files are allocated together with
+       * the shared_ptr control block, a vtable pointer and two counts. */
+      file_memory += (zoneFile->GetMemoryUsage() + 2 * sizeof(void*)) /
+                     std::max<uint32_t>(zoneFile->GetNrLinks(), 1);
+      /* The tree node of the link: color, parent, children, key and value */
+      file_memory += 4 * sizeof(void*) + sizeof(*it) +
+                     GetStringMemoryUsage(it->first);
     }
+    if (!files_.empty())
+      zbd_->GetMetrics()->ReportGeneral(ZENFS_FILE_MEMORY_SIZE,
+                                        file_memory / files_.size());
   }
   return s;
 }
@@ -417,10 +431,10 @@ IOStatus ZenFS::PersistRecord(std::string record) {
 }
 
 IOStatus ZenFS::SyncFileExtents(ZoneFile* zoneFile,
-                                std::vector<ZoneExtent*> new_extents) {
+                                const std::vector<ZoneExtent>& new_extents) {
   IOStatus s;
 
-  std::vector<ZoneExtent*> old_extents = zoneFile->GetExtents();
+  std::vector<ZoneExtent> old_extents = zoneFile->GetExtents();
   zoneFile->ReplaceExtentList(new_extents);
   zoneFile->MetadataUnsynced();
   s = SyncFileMetadata(zoneFile, true);
@@ -429,13 +443,13 @@ IOStatus ZenFS::SyncFileExtents(ZoneFile* zoneFile,
     return s;
   }
 
-  // Clear changed extents' zone stats
-  for (size_t i = 0; i < new_extents.size(); ++i) {
-    ZoneExtent* old_ext = old_extents[i];
-    if (old_ext->start_ != new_extents[i]->start_) {
-      old_ext->zone_->used_capacity_ -= old_ext->length_;
+  // Clear the zone stats of the extents that were replaced
+  std::unordered_set<uint64_t> new_starts;
+  for (const auto& ext : new_extents) new_starts.insert(ext.start_);
+  for (const auto& old_ext : old_extents) {
+    if (new_starts.count(old_ext.start_) == 0) {
+      zbd_->GetIOZone(old_ext.start_)->used_capacity_ -= old_ext.length_;
     }
-    delete old_ext;
   }
 
   return IOStatus::OK();
@@ -464,8 +478,20 @@ IOStatus ZenFS::SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace) {
   zoneFile->EncodeUpdateTo(&fileRecord);
   PutLengthPrefixedSlice(&output, Slice(fileRecord));
 
+  std::string zone_meta;
+  std::vector<Zone*> meta_zones;
+  zbd_->EncodeZoneMetaTo(&zone_meta, true, &meta_zones);
+  PutLengthPrefixedSlice(&output, Slice(zone_meta));
+
+  std::string file_meta;
+  zoneFile->EncodeFileMetaTo(&file_meta);
+  PutLengthPrefixedSlice(&output, Slice(file_meta));
+
   s = PersistRecord(output);
-  if (s.ok()) zoneFile->MetadataSynced();
+  if (s.ok())
+    zoneFile->MetadataSynced();
+  else
+    zbd_->MarkZoneMetaDirty(meta_zones);
 
   return s;
 }
@@ -514,6 +540,13 @@ IOStatus ZenFS::DeleteFileNoLock(std::string fname, const IOOptions& options,
       zoneFile->AddLinkName(fname);
     } else {
       if (zoneFile->GetNrLinks() > 0) return s;
+      /* Learn how long files of this kind live */
+      time_t now = time(0);
+      time_t c_time = zoneFile->GetFileCreationTime();
+      if (c_time == 0) c_time = zoneFile->GetFileModificationTime();
+      zbd_->GetLifetimePredictor().RecordDeletion(
+          fname, zoneFile->GetFileSize(), zoneFile->GetWriteLifeTimeHint(),
+          now > c_time ? now - c_time : 0);
       /* Mark up the file as deleted so it won't be migrated by GC */
       zoneFile->SetDeleted();
       zoneFile.reset();
@@ -757,6 +790,16 @@ IOStatus ZenFS::DeleteDirRecursive(const std::string& d,
   return s;
 }
 
+/* Metadata files that stay small, CURRENT and OPTIONS are written as .dbtmp
+ * files and renamed */
+static bool IsSmallFileType(const std::string& fname) {
+  std::string basename = fname.substr(fname.find_last_of('/') + 1);
+
+  return basename.rfind("MANIFEST", 0) == 0 ||
+         basename.rfind("OPTIONS", 0) == 0 || basename == "IDENTITY" ||
+         ends_with(basename, ".dbtmp");
+}
+
 IOStatus ZenFS::OpenWritableFile(const std::string& filename,
                                  const FileOptions& file_opts,
                                  std::unique_ptr<FSWritableFile>* result,
@@ -785,6 +828,7 @@ IOStatus ZenFS::OpenWritableFile(const std::string& filename,
     zoneFile =
         std::make_shared<ZoneFile>(zbd_, next_file_id_++, &metadata_writer_);
     zoneFile->SetFileModificationTime(time(0));
+    zoneFile->SetFileCreationTime(time(0));
     zoneFile->AddLinkName(fname);
 
     /* RocksDB does not set the right io type(!)*/
@@ -794,6 +838,14 @@ IOStatus ZenFS::OpenWritableFile(const std::string& filename,
     } else {
       zoneFile->SetIOType(IOType::kUnknown);
     }
+    zoneFile->PredictLifeTime();
+    zoneFile->SetPlacementGroup(
+        GetPlacementGroupNoLock(fname, file_opts.io_options));
+    zoneFile->SetDedicatedZones(zone_sized_files_ && ends_with(fname, ".sst"));
+    zoneFile->SetSmallFile(IsSmallFileType(fname));
+    zoneFile->SetSharedZones(
+        shared_zone_writes_ && zoneFile->GetIOType() != IOType::kWAL &&
+        !(zoneFile->GetPlacementGroup() & FIFO_PLACEMENT_GROUP));
 
     /* Persist the creation of the file */
     s = SyncFileMetadataNoLock(zoneFile);
@@ -813,16 +865,97 @@ IOStatus ZenFS::OpenWritableFile(const std::string& filename,
   return s;
 }
 
+const char* ZenFS::kPlacementGroupProperty = "zenfs.placement_group";
+
+/* Must hold files_mtx_ */
+uint32_t ZenFS::GetPlacementGroupNoLock(const std::string& fname,
+                                        const IOOptions& options) {
+  auto property = options.property_bag.find(kPlacementGroupProperty);
+  if (property != options.property_bag.end())
+    return (uint32_t)strtoul(property->second.c_str(), nullptr, 10);
+
+  /* The longest matching prefix sorts last among the matches */
+  uint32_t group = 0;
+  for (const auto& it : placement_groups_) {
+    if (fname.compare(0, it.first.length(), it.first) == 0) group = it.second;
+  }
+  return group;
+}
+
+void ZenFS::SetPlacementGroupPrefix(const std::string& prefix,
+                                    uint32_t group) {
+  std::lock_guard<std::mutex> file_lock(files_mtx_);
+  placement_groups_[FormatPathLexically(prefix)] = group;
+}
+
+void ZenFS::RemovePlacementGroupPrefix(const std::string& prefix) {
+  std::lock_guard<std::mutex> file_lock(files_mtx_);
+  placement_groups_.erase(FormatPathLexically(prefix));
+}
+
+IOStatus ZenFS::SetFilePlacementGroup(const std::string& fname,
+                                      uint32_t group) {
+  std::shared_ptr<ZoneFile> zoneFile = GetFile(FormatPathLexically(fname));
+
+  if (zoneFile == nullptr) return IOStatus::NotFound("No such file: " + fname);
+  zoneFile->SetPlacementGroup(group);
+
+  /* A writer persists the group with its next metadata sync */
+  if (!zoneFile->TryAcquireWRLock()) return IOStatus::OK();
+  IOStatus s = SyncFileMetadata(zoneFile);
+  zoneFile->ReleaseWRLock();
+  return s;
+}
+
+IOStatus ZenFS::SetFinishThreshold(uint32_t threshold) {
+  if (threshold > 100)
+    return IOStatus::InvalidArgument("Finish threshold must be 0-100");
+
+  std::lock_guard<std::mutex> lock(files_mtx_);
+  uint32_t old_threshold = superblock_->GetFinishTreshold();
+
+  superblock_->SetFinishTreshold(threshold);
+  IOStatus s = RollMetaZoneLocked();
+  if (!s.ok()) {
+    superblock_->SetFinishTreshold(old_threshold);
+    return s;
+  }
+
+  zbd_->SetFinishTreshold(threshold);
+  Info(logger_, "Finish threshold set to %u", threshold);
+  return IOStatus::OK();
+}
+
 IOStatus ZenFS::DeleteFile(const std::string& fname, const IOOptions& options,
                            IODebugContext* dbg) {
   IOStatus s;
 
   Debug(logger_, "DeleteFile: %s \n", fname.c_str());
 
+  std::vector<Zone*> fifo_zones;
   files_mtx_.lock();
+  std::shared_ptr<ZoneFile> zoneFile =
+      GetFileNoLock(FormatPathLexically(fname));
+  if (zoneFile != nullptr &&
+      (zoneFile->GetPlacementGroup() & FIFO_PLACEMENT_GROUP)) {
+    for (const auto& extent : zoneFile->GetExtents()) {
+      Zone* zone = zbd_->GetIOZone(extent.start_);
+      if (std::find(fifo_zones.begin(), fifo_zones.end(), zone) ==
+          fifo_zones.end())
+        fifo_zones.push_back(zone);
+    }
+  }
+  zoneFile.reset();
   s = DeleteFileNoLock(fname, options, dbg);
   files_mtx_.unlock();
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
+  if (s.ok()) {
+    /* Files of a FIFO group only share zones with their neighbours in
+     * creation order, so only the zones of the file may have become free */
+    if (fifo_zones.empty())
+      s = zbd_->ResetUnusedIOZones();
+    else
+      s = zbd_->ResetUnusedIOZones(fifo_zones);
+  }
   zbd_->LogZoneStats();
 
   return s;
@@ -1084,6 +1217,15 @@ void ZenFS::EncodeSnapshotTo(std::string* output) {
     PutLengthPrefixedSlice(&files_string, Slice(file_string));
   }
   PutLengthPrefixedSlice(output, Slice(files_string));
+
+  std::string zone_meta;
+  zbd_->EncodeZoneMetaTo(&zone_meta, false);
+  PutLengthPrefixedSlice(output, Slice(zone_meta));
+
+  std::string file_meta;
+  for (it = files_.begin(); it != files_.end(); it++)
+    it->second->EncodeFileMetaTo(&file_meta);
+  PutLengthPrefixedSlice(output, Slice(file_meta));
 }
 
 void ZenFS::EncodeJson(std::ostream& json_stream) {
@@ -1101,7 +1243,8 @@ void ZenFS::EncodeJson(std::ostream& json_stream) {
 }
 
 Status ZenFS::DecodeFileUpdateFrom(Slice* slice, bool replace) {
-  std::shared_ptr<ZoneFile> update(new ZoneFile(zbd_, 0, &metadata_writer_));
+  std::shared_ptr<ZoneFile> update =
+      std::make_shared<ZoneFile>(zbd_, 0, &metadata_writer_);
   uint64_t id;
   Status s;
 
@@ -1147,8 +1290,8 @@ Status ZenFS::DecodeSnapshotFrom(Slice* input) {
   assert(files_.size() == 0);
 
   while (GetLengthPrefixedSlice(input, &slice)) {
-    std::shared_ptr<ZoneFile> zoneFile(
-        new ZoneFile(zbd_, 0, &metadata_writer_));
+    std::shared_ptr<ZoneFile> zoneFile =
+        std::make_shared<ZoneFile>(zbd_, 0, &metadata_writer_);
     Status s = zoneFile->DecodeFrom(&slice);
     if (!s.ok()) return s;
 
@@ -1201,6 +1344,28 @@ Status ZenFS::DecodeFileDeletionFrom(Slice* input) {
   return Status::OK();
 }
 
+Status ZenFS::DecodeFileMetaFrom(Slice* input) {
+  std::unordered_map<uint64_t, ZoneFile*> files_by_id;
+  Slice file_meta;
+
+  for (const auto& it : files_)
+    files_by_id[it.second->GetID()] = it.second.get();
+
+  while (GetLengthPrefixedSlice(input, &file_meta)) {
+    uint64_t id;
+    if (!GetFixed64(&file_meta, &id))
+      return Status::Corruption("File meta data", "Missing file ID");
+
+    /* The file may have been deleted since */
+    auto it = files_by_id.find(id);
+    if (it == files_by_id.end()) continue;
+    Status s = it->second->DecodeFileMetaFrom(&file_meta);
+    if (!s.ok()) return s;
+  }
+
+  return Status::OK();
+}
+
 Status ZenFS::RecoverFrom(ZenMetaLog* log) {
   bool at_least_one_snapshot = false;
   std::string scratch;
@@ -1269,6 +1434,25 @@ Status ZenFS::RecoverFrom(ZenMetaLog* log) {
         Warn(logger_, "Unexpected metadata record tag: %u", tag);
         return Status::Corruption("ZenFS", "Unexpected tag");
     }
+
+    /* Zone placement meta data and then file meta data may trail snapshot
+     * and file update records, where older versions ignore them */
+    if (GetLengthPrefixedSlice(&record, &data)) {
+      s = zbd_->DecodeZoneMetaFrom(&data);
+      if (!s.ok()) {
+        Warn(logger_, "Could not decode zone meta data: %s",
+             s.ToString().c_str());
+        return s;
+      }
+    }
+    if (GetLengthPrefixedSlice(&record, &data)) {
+      s = DecodeFileMetaFrom(&data);
+      if (!s.ok()) {
+        Warn(logger_, "Could not decode file meta data: %s",
+             s.ToString().c_str());
+        return s;
+      }
+    }
   }
 
   if (at_least_one_snapshot)
@@ -1412,10 +1596,11 @@ Status ZenFS::Mount(bool readonly) {
   Info(logger_, "Filesystem mount OK");
 
   if (!readonly) {
-    Info(logger_, "Resetting unused IO Zones..");
-    IOStatus status = zbd_->ResetUnusedIOZones();
-    if (!status.ok()) return status;
-    Info(logger_, "  Done");
+    /* Serve the database while the zones are reset, allocations wait for
+     * the resets only when no zone is empty */
+    Info(logger_, "Resetting unused IO Zones in the background");
+    zbd_->StartMountReset();
+    zbd_->StartZonePools();
   }
 
   LogFiles();
@@ -1506,14 +1691,32 @@ static std::string GetLogFilename(std::string bdev) {
   char buf[40];
 
   std::strftime(buf, sizeof(buf), "%Y-%m-%d_%H:%M:%S.log", log_start);
+  /* Emulated device names may contain a path */
+  std::replace(bdev.begin(), bdev.end(), '/', '_');
   ss << DEFAULT_ZENV_LOG_PATH << std::string("zenfs_") << bdev << "_" << buf;
 
   return ss.str();
 }
 #endif
 
+Status ZenFS::SetAllocationPolicy(const std::string& name) {
+  std::shared_ptr<ZoneAllocationPolicy> policy;
+  Status s = NewZoneAllocationPolicy(name, &policy);
+  if (!s.ok()) return s;
+
+  zbd_->SetAllocationPolicy(policy);
+  Info(logger_, "Zone allocation policy: %s", policy->Name());
+  return Status::OK();
+}
+
 Status NewZenFS(FileSystem** fs, const std::string& bdevname,
                 std::shared_ptr<ZenFSMetrics> metrics) {
+  return NewZenFS(fs, bdevname, ZenFSOptions(), metrics);
+}
+
+Status NewZenFS(FileSystem** fs, const std::string& bdevname,
+                const ZenFSOptions& options,
+                std::shared_ptr<ZenFSMetrics> metrics) {
   std::shared_ptr<Logger> logger;
   Status s;
 
@@ -1543,6 +1746,11 @@ Status NewZenFS(FileSystem** fs, const std::string& bdevname,
   }
 
   ZenFS* zenFS = new ZenFS(zbd, FileSystem::Default(), logger);
+  s = zenFS->SetAllocationPolicy(options.alloc_policy);
+  if (!s.ok()) {
+    delete zenFS;
+    return s;
+  }
   s = zenFS->Mount(false);
   if (!s.ok()) {
     delete zenFS;
@@ -1628,8 +1836,9 @@ void ZenFS::GetZenFSSnapshot(ZenFSSnapshot& snapshot,
       // file -> extents mapping
       snapshot.zone_files_.emplace_back(file);
       // extent -> file mapping
-      for (auto* ext : file.GetExtents()) {
-        snapshot.extents_.emplace_back(*ext, file.GetFilename());
+      for (const auto& ext : file.GetExtents()) {
+        snapshot.extents_.emplace_back(ext, *zbd_->GetIOZone(ext.start_),
+                                       file.GetFilename());
       }
 
       file.ReleaseWRLock();
@@ -1645,6 +1854,64 @@ void ZenFS::GetZenFSSnapshot(ZenFSSnapshot& snapshot,
   }
 }
 
+void ZenFS::GetReclaimCandidates(std::vector<ZoneReclaimCandidate>& candidates,
+                                 uint32_t min_garbage_pct) {
+  ZenFSSnapshot snapshot;
+  ZenFSSnapshotOptions options;
+
+  options.zone_ = 1;
+  options.zone_file_ = 1;
+  GetZenFSSnapshot(snapshot, options);
+
+  std::map<uint64_t, const ZoneSnapshot*> zones;
+  for (const auto& zone : snapshot.zones_) zones[zone.start] = &zone;
+
+  for (const auto& file : snapshot.zone_files_) {
+    // Only SST files can be compacted away
+    if (!ends_with(file.filename, ".sst")) continue;
+
+    std::map<uint64_t, uint64_t> zone_bytes;
+    uint64_t file_size = 0;
+    for (const auto& ext : file.extents) {
+      zone_bytes[ext.zone_start] += ext.length;
+      file_size += ext.length;
+    }
+
+    ZoneReclaimCandidate candidate(file.filename, file_size);
+    for (const auto& it : zone_bytes) {
+      auto zone_it = zones.find(it.first);
+      if (zone_it == zones.end()) continue;
+
+      const ZoneSnapshot* zone = zone_it->second;
+      uint64_t written = zone->wp - zone->start;
+      if (zone->used_capacity == 0 || written <= zone->used_capacity) continue;
+
+      uint64_t garbage = written - zone->used_capacity;
+
+      /* Open zones may still receive data, only full zones can be reset
+       * as soon as their last valid data is gone. All of the zone is freed
+       * then, the garbage and the file's own data. */
+      if (zone->capacity == 0 && it.second >= zone->used_capacity) {
+        candidate.reclaimable += written;
+      }
+
+      if (100 * garbage / zone->max_capacity >= min_garbage_pct) {
+        candidate.pinned_garbage += garbage * it.second / zone->used_capacity;
+      }
+    }
+
+    if (candidate.reclaimable > 0 || candidate.pinned_garbage > 0)
+      candidates.push_back(candidate);
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](const ZoneReclaimCandidate& a, const ZoneReclaimCandidate& b) {
+              if (a.reclaimable != b.reclaimable)
+                return a.reclaimable > b.reclaimable;
+              return a.pinned_garbage > b.pinned_garbage;
+            });
+}
+
 IOStatus ZenFS::MigrateExtents(
     const std::vector<ZoneExtentSnapshot*>& extents) {
   IOStatus s;
@@ -1685,33 +1952,29 @@ IOStatus ZenFS::MigrateFileExtents(
   if (!zfile->TryAcquireWRLock()) {
     return IOStatus::OK();
   }
+  zfile->PredictLifeTime();
 
-  std::vector<ZoneExtent*> new_extent_list;
-  std::vector<ZoneExtent*> extents = zfile->GetExtents();
-  for (const auto* ext : extents) {
-    new_extent_list.push_back(
-        new ZoneExtent(ext->start_, ext->length_, ext->zone_));
-  }
+  std::vector<ZoneExtent> new_extent_list = zfile->GetExtents();
 
   // Modify the new extent list
-  for (ZoneExtent* ext : new_extent_list) {
+  for (ZoneExtent& ext : new_extent_list) {
     // Check if current extent need to be migrated
     auto it = std::find_if(migrate_exts.begin(), migrate_exts.end(),
                            [&](const ZoneExtentSnapshot* ext_snapshot) {
-                             return ext_snapshot->start == ext->start_ &&
-                                    ext_snapshot->length == ext->length_;
+                             return ext_snapshot->start == ext.start_ &&
+                                    ext_snapshot->length == ext.length_;
                            });
 
     if (it == migrate_exts.end()) {
-      Info(logger_, "Migrate extent not found, ext_start: %lu", ext->start_);
+      Info(logger_, "Migrate extent not found, ext_start: %lu", ext.start_);
       continue;
     }
 
     Zone* target_zone = nullptr;
 
     // Allocate a new migration zone.
-    s = zbd_->TakeMigrateZone(&target_zone, zfile->GetWriteLifeTimeHint(),
-                              ext->length_);
+    s = zbd_->TakeMigrateZone(&target_zone, zfile->GetPlacementLifeTime(),
+                              zfile->GetPlacementGroup(), ext.length_);
     if (!s.ok()) {
       continue;
     }
@@ -1727,13 +1990,13 @@ IOStatus ZenFS::MigrateFileExtents(
       // For buffered write, ZenFS use inlined metadata for extents and each
       // extent has a SPARSE_HEADER_SIZE.
       target_start = target_zone->wp_ + ZoneFile::SPARSE_HEADER_SIZE;
-      zfile->MigrateData(ext->start_ - ZoneFile::SPARSE_HEADER_SIZE,
-                         ext->length_ + ZoneFile::SPARSE_HEADER_SIZE,
+      zfile->MigrateData(ext.start_ - ZoneFile::SPARSE_HEADER_SIZE,
+                         ext.length_ + ZoneFile::SPARSE_HEADER_SIZE,
                          target_zone);
-      zbd_->AddGCBytesWritten(ext->length_ + ZoneFile::SPARSE_HEADER_SIZE);
+      zbd_->AddGCBytesWritten(ext.length_ + ZoneFile::SPARSE_HEADER_SIZE);
     } else {
-      zfile->MigrateData(ext->start_, ext->length_, target_zone);
-      zbd_->AddGCBytesWritten(ext->length_);
+      zfile->MigrateData(ext.start_, ext.length_, target_zone);
+      zbd_->AddGCBytesWritten(ext.length_);
     }
 
     // If the file doesn't exist, skip
@@ -1743,9 +2006,8 @@ IOStatus ZenFS::MigrateFileExtents(
       break;
     }
 
-    ext->start_ = target_start;
-    ext->zone_ = target_zone;
-    ext->zone_->used_capacity_ += ext->length_;
+    ext.start_ = target_start;
+    target_zone->used_capacity_ += ext.length_;
 
     zbd_->ReleaseMigrateZone(target_zone);
   }
@@ -1758,6 +2020,110 @@ IOStatus ZenFS::MigrateFileExtents(
   return IOStatus::OK();
 }
 
+IOStatus ZenFS::DefragmentFile(const std::string& fname) {
+  IOStatus s;
+
+  auto zfile = GetFile(fname);
+  if (zfile == nullptr) return IOStatus::OK();
+  if (zfile->GetNrExtents() <= 1) return IOStatus::OK();
+
+  // Only closed files are rewritten, and they can't be reopened for writing
+  // while we are at it
+  if (!zfile->TryAcquireWRLock()) return IOStatus::OK();
+
+  std::vector<ZoneExtent> new_extents;
+  uint64_t file_size = zfile->GetFileSize();
+  uint64_t offset = 0;
+  uint32_t header_sz = zfile->IsSparse() ? ZoneFile::SPARSE_HEADER_SIZE : 0;
+
+  while (offset < file_size) {
+    Zone* target_zone = nullptr;
+    uint32_t min_capacity = zbd_->GetBlockSize();
+
+    s = zbd_->TakeMigrateZone(&target_zone, zfile->GetPlacementLifeTime(),
+                              zfile->GetPlacementGroup(), min_capacity);
+    if (!s.ok()) break;
+    if (target_zone == nullptr) {
+      zbd_->ReleaseMigrateZone(target_zone);
+      Info(logger_, "No zone to defragment %s to", fname.c_str());
+      break;
+    }
+
+    uint32_t length = std::min<uint64_t>(file_size - offset,
+                                         target_zone->capacity_ - header_sz);
+    uint64_t extent_start;
+    s = zfile->RewriteData(offset, length, target_zone, &extent_start);
+    if (s.ok()) {
+      target_zone->used_capacity_ += length;
+      new_extents.emplace_back(extent_start, length);
+      zbd_->AddGCBytesWritten(length + header_sz);
+      offset += length;
+    }
+    zbd_->ReleaseMigrateZone(target_zone);
+    if (!s.ok()) break;
+  }
+
+  bool done = offset == file_size && new_extents.size() < zfile->GetNrExtents();
+  if (s.ok() && done && !zfile->IsDeleted()) {
+    Info(logger_, "Defragmented %s from %lu to %lu extents", fname.c_str(),
+         zfile->GetNrExtents(), new_extents.size());
+    s = SyncFileExtents(zfile.get(), new_extents);
+  } else {
+    // Drop the copies, the data is garbage now and the file stays as is
+    for (const auto& ext : new_extents)
+      zbd_->GetIOZone(ext.start_)->used_capacity_ -= ext.length_;
+  }
+
+  zfile->ReleaseWRLock();
+  return s;
+}
+
+IOStatus ZenFS::DefragmentFiles(uint32_t min_extents) {
+  std::vector<std::string> fnames;
+  IOStatus s;
+
+  {
+    std::lock_guard<std::mutex> lock(files_mtx_);
+    for (const auto& it : files_) {
+      if (it.second->GetNrExtents() >= min_extents &&
+          !it.second->IsOpenForWR())
+        fnames.push_back(it.first);
+    }
+  }
+
+  for (const auto& fname : fnames) {
+    s = DefragmentFile(fname);
+    if (!s.ok()) break;
+  }
+  if (s.ok()) s = zbd_->ResetUnusedIOZones();
+  return s;
+}
+
+/* Split the options off a device id like dev:nvme0n1?policy=greedy */
+static Status ParseZenFSOptions(std::string* devID, ZenFSOptions* options) {
+  size_t pos = devID->find('?');
+  if (pos == std::string::npos) return Status::OK();
+
+  std::stringstream ss(devID->substr(pos + 1));
+  std::string option;
+  devID->erase(pos);
+
+  while (std::getline(ss, option, '&')) {
+    size_t eq = option.find('=');
+    if (eq == std::string::npos)
+      return Status::InvalidArgument("Malformed option: " + option);
+
+    std::string key = option.substr(0, eq);
+    std::string value = option.substr(eq + 1);
+    if (key == "policy") {
+      options->alloc_policy = value;
+    } else {
+      return Status::InvalidArgument("Unknown option: " + key);
+    }
+  }
+  return Status::OK();
+}
+
 extern "C" FactoryFunc<FileSystem> zenfs_filesystem_reg;
 
 FactoryFunc<FileSystem> zenfs_filesystem_reg =
@@ -1774,12 +2140,16 @@ FactoryFunc<FileSystem> zenfs_filesystem_reg =
 #endif
           std::string devID = uri;
           FileSystem* fs = nullptr;
+          ZenFSOptions options;
           Status s;
 
           devID.replace(0, strlen("zenfs://"), "");
-          if (devID.rfind("dev:") == 0) {
+          s = ParseZenFSOptions(&devID, &options);
+          if (!s.ok()) {
+            *errmsg = s.ToString();
+          } else if (devID.rfind("dev:") == 0) {
             devID.replace(0, strlen("dev:"), "");
-            s = NewZenFS(&fs, devID);
+            s = NewZenFS(&fs, devID, options);
             if (!s.ok()) {
               *errmsg = s.ToString();
             }
@@ -1794,7 +2164,7 @@ FactoryFunc<FileSystem> zenfs_filesystem_reg =
               if (zenFileSystems.find(devID) == zenFileSystems.end()) {
                 *errmsg = "UUID not found";
               } else {
-                s = NewZenFS(&fs, zenFileSystems[devID]);
+                s = NewZenFS(&fs, zenFileSystems[devID], options);
                 if (!s.ok()) {
                   *errmsg = s.ToString();
                 }
@@ -1817,6 +2187,11 @@ Status NewZenFS(FileSystem** /*fs*/, const std::string& /*bdevname*/,
                 ZenFSMetrics* /*metrics*/) {
   return Status::NotSupported("Not built with ZenFS support\n");
 }
+Status NewZenFS(FileSystem** /*fs*/, const std::string& /*bdevname*/,
+                const ZenFSOptions& /*options*/,
+                std::shared_ptr<ZenFSMetrics> /*metrics*/) {
+  return Status::NotSupported("Not built with ZenFS support\n");
+}
 std::map<std::string, std::string> ListZenFileSystems() {
   std::map<std::string, std::string> zenFileSystems;
   return zenFileSystems;
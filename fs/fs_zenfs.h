@@ -33,6 +33,7 @@ class ZoneSnapshot;
 class ZoneFileSnapshot;
 class ZenFSSnapshot;
 class ZenFSSnapshotOptions;
+class ZoneReclaimCandidate;
 
 class Superblock {
   uint32_t magic_ = 0;
@@ -89,6 +90,7 @@ class Superblock {
   uint32_t GetSeq() { return sequence_; }
   std::string GetAuxFsPath() { return std::string(aux_fs_path_); }
   uint32_t GetFinishTreshold() { return finish_treshold_; }
+  void SetFinishTreshold(uint32_t threshold) { finish_treshold_ = threshold; }
   std::string GetUUID() { return std::string(uuid_); }
 };
 
@@ -131,6 +133,10 @@ class ZenFS : public FileSystemWrapper {
   ZonedBlockDevice* zbd_;
   std::map<std::string, std::shared_ptr<ZoneFile>> files_;
   std::mutex files_mtx_;
+  /* File name prefix to placement group, protected by files_mtx_ */
+  std::map<std::string, uint32_t> placement_groups_;
+  bool zone_sized_files_ = false;
+  bool shared_zone_writes_ = false;
   std::shared_ptr<Logger> logger_;
   std::atomic<uint64_t> next_file_id_;
 
@@ -152,6 +158,8 @@ class ZenFS : public FileSystemWrapper {
 
   ZenFSMetadataWriter metadata_writer_;
 
+  /* Snapshot and file update records may be followed by the placement meta
+   * data of the zones written since, which older versions ignore. */
   enum ZenFSTag : uint32_t {
     kCompleteFilesSnapshot = 1,
     kFileUpdate = 2,
@@ -169,7 +177,7 @@ class ZenFS : public FileSystemWrapper {
   IOStatus PersistSnapshot(ZenMetaLog* meta_writer);
   IOStatus PersistRecord(std::string record);
   IOStatus SyncFileExtents(ZoneFile* zoneFile,
-                           std::vector<ZoneExtent*> new_extents);
+                           const std::vector<ZoneExtent>& new_extents);
   /* Must hold files_mtx_ */
   IOStatus SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace = false);
   /* Must hold files_mtx_ */
@@ -190,6 +198,7 @@ class ZenFS : public FileSystemWrapper {
   Status DecodeSnapshotFrom(Slice* input);
   Status DecodeFileUpdateFrom(Slice* slice, bool replace = false);
   Status DecodeFileDeletionFrom(Slice* slice);
+  Status DecodeFileMetaFrom(Slice* input);
 
   Status RecoverFrom(ZenMetaLog* log);
 
@@ -206,6 +215,9 @@ class ZenFS : public FileSystemWrapper {
   /* Must hold files_mtx_ */
   std::shared_ptr<ZoneFile> GetFileNoLock(std::string fname);
   /* Must hold files_mtx_ */
+  uint32_t GetPlacementGroupNoLock(const std::string& fname,
+                                   const IOOptions& options);
+  /* Must hold files_mtx_ */
   void GetZenFSChildrenNoLock(const std::string& dir,
                               bool include_grandchildren,
                               std::vector<std::string>* result);
@@ -282,6 +294,10 @@ class ZenFS : public FileSystemWrapper {
 
   void ReportSuperblock(std::string* report) { superblock_->GetReport(report); }
 
+  /* Change the finish threshold of a mounted file system. The new threshold
+   * is persisted in the superblock right away. */
+  IOStatus SetFinishThreshold(uint32_t threshold);
+
   virtual IOStatus NewSequentialFile(const std::string& fname,
                                      const FileOptions& file_opts,
                                      std::unique_ptr<FSSequentialFile>* result,
@@ -442,17 +458,97 @@ class ZenFS : public FileSystemWrapper {
   void GetZenFSSnapshot(ZenFSSnapshot& snapshot,
                         const ZenFSSnapshotOptions& options);
 
+  /* Rank SST files by how much zone space deleting them would free, best
+   * candidates first. Compacting these away reclaims zones without
+   * migrating any data. Zones with less than min_garbage_pct garbage do not
+   * contribute to the pinned garbage score. */
+  void GetReclaimCandidates(std::vector<ZoneReclaimCandidate>& candidates,
+                            uint32_t min_garbage_pct = 0);
+
+  /* Placement groups keep files that will be deleted together, e.g. the
+   * outputs of a compaction job or the files of a column family, in their
+   * own zones so that the zones can be reset without migrating data.
+   * Group 0 is the default group shared by all other files.
+   *
+   * A new file is assigned to the group set by the kPlacementGroupProperty
+   * entry of the IOOptions property bag it is opened with, or else the group
+   * of the longest file name prefix registered here.
+   *
+   * Groups with the FIFO_PLACEMENT_GROUP bit set, e.g. for a FIFO compacted
+   * or TTL column family, never share zones with other groups and lay out
+   * their files in creation order. Deleting a file resets its zones right
+   * away instead of scanning all zones. */
+  static const char* kPlacementGroupProperty;
+  void SetPlacementGroupPrefix(const std::string& prefix, uint32_t group);
+  void RemovePlacementGroupPrefix(const std::string& prefix);
+  /* Move a file to a group, applies to the zones allocated from now on */
+  IOStatus SetFilePlacementGroup(const std::string& fname, uint32_t group);
+
+  /* In zone sized file mode, SST files that are expected to fill a zone
+   * get an empty zone of their own, so that deleting the file frees the
+   * zone without any garbage collection. RocksDB's target file size should
+   * be set from the usable zone capacity for this to be effective. */
+  void SetZoneSizedFiles(bool enabled) { zone_sized_files_ = enabled; }
+  uint64_t GetUsableZoneCapacity() { return zbd_->GetUsableZoneCapacity(); }
+
+  /* Let files other than WALs and FIFO placement groups append to the same
+   * open zones, so that more files than the device has open zones can be
+   * written without waiting for open zone tokens. */
+  void SetSharedZoneWrites(bool enabled) { shared_zone_writes_ = enabled; }
+
+  /* Open and active zones are handed out by class, WAL writes first, then
+   * flushes, compactions and garbage collection. Each class can be given a
+   * guaranteed number of zones and a weight for sharing the rest. */
+  void SetZoneIOClassOptions(ZoneIOClass io_class,
+                             const ZoneIOClassOptions& options) {
+    zbd_->SetZoneIOClassOptions(io_class, options);
+  }
+
+  /* Number of empty zones kept ready for a class, by default one for WAL
+   * writes and one for flushes. A WAL or flush file that fills its zone
+   * switches to a pooled zone without running the zone allocator. */
+  void SetZonePoolSize(ZoneIOClass io_class, uint32_t size) {
+    zbd_->SetZonePoolSize(io_class, size);
+  }
+
+  /* Limits of the write buffers of buffered files, see WriteBufferPool */
+  void SetWriteBufferPoolOptions(const WriteBufferPoolOptions& options) {
+    zbd_->GetWriteBufferPool()->SetOptions(options);
+  }
+
+  /* Pick the zone allocation policy by name, see ZoneAllocationPolicy */
+  Status SetAllocationPolicy(const std::string& name);
+
   IOStatus MigrateExtents(const std::vector<ZoneExtentSnapshot*>& extents);
 
   IOStatus MigrateFileExtents(
       const std::string& fname,
       const std::vector<ZoneExtentSnapshot*>& migrate_exts);
+
+  /* Rewrite the data of a closed file into as few extents as possible, one
+   * per zone. Files appended to in small syncs, like WALs and MANIFESTs,
+   * end up with an extent per sync otherwise. Files open for writing are
+   * skipped. Meant to be run in the background, like MigrateExtents. */
+  IOStatus DefragmentFile(const std::string& fname);
+  /* Defragment the closed files with at least min_extents extents and reset
+   * the zones that were freed up */
+  IOStatus DefragmentFiles(uint32_t min_extents);
 };
 #endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
 
+/* Options of a file system opened with NewZenFS. These can also be passed in
+ * the zenfs:// URI, as in zenfs://dev:<device>?policy=<name> */
+struct ZenFSOptions {
+  /* Name of the zone allocation policy */
+  std::string alloc_policy = "default";
+};
+
 Status NewZenFS(
     FileSystem** fs, const std::string& bdevname,
     std::shared_ptr<ZenFSMetrics> metrics = std::make_shared<NoZenFSMetrics>());
+Status NewZenFS(
+    FileSystem** fs, const std::string& bdevname, const ZenFSOptions& options,
+    std::shared_ptr<ZenFSMetrics> metrics = std::make_shared<NoZenFSMetrics>());
 Status ListZenFileSystems(std::map<std::string, std::string>& out_list);
 
 }  // namespace ROCKSDB_NAMESPACE
@@ -19,8 +19,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -29,30 +31,79 @@
 
 namespace ROCKSDB_NAMESPACE {
 
-ZoneExtent::ZoneExtent(uint64_t start, uint64_t length, Zone* zone)
-    : start_(start), length_(length), zone_(zone) {}
+/* Files expected to fill at most this fraction of a zone are packed into the
+ * tails of partially written zones */
+#define ZENFS_SMALL_FILE_RATIO (8)
+
+/* Write buffers of a buffered file, the one being filled included. Full
+ * buffers are written in the background while there are others to fill. */
+#define ZENFS_WRITE_BEHIND_BUFFERS (2)
+
+ZoneExtent::ZoneExtent(uint64_t start, uint32_t length)
+    : start_(start), length_(length) {}
 
 Status ZoneExtent::DecodeFrom(Slice* input) {
-  if (input->size() != (sizeof(start_) + sizeof(length_)))
+  uint64_t length;
+
+  /* The length is persisted as 64 bits */
+  if (input->size() != (sizeof(start_) + sizeof(length)))
     return Status::Corruption("ZoneExtent", "Error: length missmatch");
 
   GetFixed64(input, &start_);
-  GetFixed64(input, &length_);
+  GetFixed64(input, &length);
+  if (length > UINT32_MAX)
+    return Status::Corruption("ZoneExtent", "Error: extent too long");
+  length_ = length;
   return Status::OK();
 }
 
-void ZoneExtent::EncodeTo(std::string* output) {
+void ZoneExtent::EncodeTo(std::string* output) const {
   PutFixed64(output, start_);
   PutFixed64(output, length_);
 }
 
-void ZoneExtent::EncodeJson(std::ostream& json_stream) {
+void ZoneExtent::EncodeJson(std::ostream& json_stream) const {
   json_stream << "{";
   json_stream << "\"start\":" << start_ << ",";
   json_stream << "\"length\":" << length_;
   json_stream << "}";
 }
 
+/* Directories of link names, never freed as there are only a few */
+static const std::string* InternDirName(const std::string& dir) {
+  static std::mutex dirs_mtx;
+  static std::unordered_set<std::string>* dirs =
+      new std::unordered_set<std::string>();
+
+  std::lock_guard<std::mutex> lock(dirs_mtx);
+  return &*dirs->insert(dir).first;
+}
+
+ZoneFileLink::ZoneFileLink(const std::string& path) {
+  size_t sep = path.rfind('/') + 1;
+  dir_ = InternDirName(path.substr(0, sep));
+  name_ = path.substr(sep);
+}
+
+bool ZoneFileLink::Is(const std::string& path) const {
+  return path.size() == dir_->size() + name_.size() &&
+         path.compare(0, dir_->size(), *dir_) == 0 &&
+         path.compare(dir_->size(), name_.size(), name_) == 0;
+}
+
+size_t GetStringMemoryUsage(const std::string& str) {
+  const char* data = str.data();
+  const char* self = reinterpret_cast<const char*>(&str);
+
+  /* Short strings are stored inside the string object */
+  if (data >= self && data < self + sizeof(str)) return 0;
+  return str.capacity() + 1;
+}
+
+size_t ZoneFileLink::GetMemoryUsage() const {
+  return GetStringMemoryUsage(name_);
+}
+
 enum ZoneFileTag : uint32_t {
   kFileID = 1,
   kFileNameDeprecated = 2,
@@ -79,7 +130,7 @@ void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
     std::string extent_str;
 
     PutFixed32(output, kExtent);
-    extents_[i]->EncodeTo(&extent_str);
+    extents_[i].EncodeTo(&extent_str);
     PutLengthPrefixedSlice(output, Slice(extent_str));
   }
 
@@ -100,7 +151,7 @@ void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
 
   for (uint32_t i = 0; i < linkfiles_.size(); i++) {
     PutFixed32(output, kLinkedFilename);
-    PutLengthPrefixedSlice(output, Slice(linkfiles_[i]));
+    PutLengthPrefixedSlice(output, Slice(linkfiles_[i].GetPath()));
   }
 }
 
@@ -115,13 +166,13 @@ void ZoneFile::EncodeJson(std::ostream& json_stream) {
     json_stream << "\"filename\":\"" << name << "\",";
 
   bool first_element = true;
-  for (ZoneExtent* extent : extents_) {
+  for (const ZoneExtent& extent : extents_) {
     if (first_element) {
       first_element = false;
     } else {
       json_stream << ",";
     }
-    extent->EncodeJson(json_stream);
+    extent.EncodeJson(json_stream);
   }
   json_stream << "]}";
 }
@@ -135,7 +186,8 @@ Status ZoneFile::DecodeFrom(Slice* input) {
 
   while (true) {
     Slice slice;
-    ZoneExtent* extent;
+    ZoneExtent extent;
+    Zone* zone;
     Status s;
 
     if (!GetFixed32(input, &tag)) break;
@@ -150,19 +202,16 @@ Status ZoneFile::DecodeFrom(Slice* input) {
         if (!GetFixed32(input, &lt))
           return Status::Corruption("ZoneFile", "Missing life time hint");
         lifetime_ = (Env::WriteLifeTimeHint)lt;
+        placement_lifetime_ = lifetime_;
         break;
       case kExtent:
-        extent = new ZoneExtent(0, 0, nullptr);
         GetLengthPrefixedSlice(input, &slice);
-        s = extent->DecodeFrom(&slice);
-        if (!s.ok()) {
-          delete extent;
-          return s;
-        }
-        extent->zone_ = zbd_->GetIOZone(extent->start_);
-        if (!extent->zone_)
+        s = extent.DecodeFrom(&slice);
+        if (!s.ok()) return s;
+        zone = zbd_->GetIOZone(extent.start_);
+        if (!zone)
           return Status::Corruption("ZoneFile", "Invalid zone extent");
-        extent->zone_->used_capacity_ += extent->length_;
+        zone->used_capacity_ += extent.length_;
         extents_.push_back(extent);
         break;
       case kModificationTime:
@@ -187,7 +236,7 @@ Status ZoneFile::DecodeFrom(Slice* input) {
         if (slice.ToString().length() == 0)
           return Status::Corruption("ZoneFile", "Zero length Linkfilename");
 
-        linkfiles_.push_back(slice.ToString());
+        linkfiles_.emplace_back(slice.ToString());
         break;
       default:
         return Status::Corruption("ZoneFile", "Unexpected tag");
@@ -198,6 +247,27 @@ Status ZoneFile::DecodeFrom(Slice* input) {
   return Status::OK();
 }
 
+void ZoneFile::EncodeFileMetaTo(std::string* output) {
+  std::string file_meta;
+
+  PutFixed64(&file_meta, file_id_);
+  PutFixed64(&file_meta, (uint64_t)c_time_);
+  PutFixed32(&file_meta, placement_group_.load());
+  PutLengthPrefixedSlice(output, Slice(file_meta));
+}
+
+Status ZoneFile::DecodeFileMetaFrom(Slice* input) {
+  uint64_t c_time;
+  uint32_t placement_group;
+
+  if (!GetFixed64(input, &c_time) || !GetFixed32(input, &placement_group))
+    return Status::Corruption("File meta data", "Missing file fields");
+  /* Trailing fields are ignored to allow for future additions */
+  c_time_ = (time_t)c_time;
+  placement_group_ = placement_group;
+  return Status::OK();
+}
+
 Status ZoneFile::MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace) {
   if (file_id_ != update->GetID())
     return Status::Corruption("ZoneFile update", "ID missmatch");
@@ -210,19 +280,15 @@ Status ZoneFile::MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace) {
     ClearExtents();
   }
 
-  std::vector<ZoneExtent*> update_extents = update->GetExtents();
-  for (long unsigned int i = 0; i < update_extents.size(); i++) {
-    ZoneExtent* extent = update_extents[i];
-    Zone* zone = extent->zone_;
-    zone->used_capacity_ += extent->length_;
-    extents_.push_back(new ZoneExtent(extent->start_, extent->length_, zone));
+  for (const ZoneExtent& extent : update->extents_) {
+    zbd_->GetIOZone(extent.start_)->used_capacity_ += extent.length_;
+    extents_.push_back(extent);
   }
   extent_start_ = update->GetExtentStart();
   is_sparse_ = update->IsSparse();
   MetadataSynced();
 
-  linkfiles_.clear();
-  for (const auto& name : update->GetLinkFiles()) linkfiles_.push_back(name);
+  linkfiles_ = update->linkfiles_;
 
   return Status::OK();
 }
@@ -233,15 +299,17 @@ ZoneFile::ZoneFile(ZonedBlockDevice* zbd, uint64_t file_id,
       active_zone_(NULL),
       extent_start_(NO_EXTENT),
       extent_filepos_(0),
-      lifetime_(Env::WLTH_NOT_SET),
-      io_type_(IOType::kUnknown),
       file_size_(0),
       file_id_(file_id),
-      nr_synced_extents_(0),
       m_time_(0),
-      metadata_writer_(metadata_writer) {}
+      c_time_(0),
+      metadata_writer_(metadata_writer),
+      lifetime_(Env::WLTH_NOT_SET),
+      placement_lifetime_(Env::WLTH_NOT_SET),
+      nr_synced_extents_(0),
+      io_type_(IOType::kUnknown) {}
 
-std::string ZoneFile::GetFilename() { return linkfiles_[0]; }
+std::string ZoneFile::GetFilename() { return linkfiles_[0].GetPath(); }
 time_t ZoneFile::GetFileModificationTime() { return m_time_; }
 
 uint64_t ZoneFile::GetFileSize() { return file_size_; }
@@ -252,28 +320,33 @@ void ZoneFile::SetIOType(IOType io_type) { io_type_ = io_type; }
 ZoneFile::~ZoneFile() { ClearExtents(); }
 
 void ZoneFile::ClearExtents() {
-  for (auto e = std::begin(extents_); e != std::end(extents_); ++e) {
-    Zone* zone = (*e)->zone_;
+  for (const ZoneExtent& extent : extents_) {
+    Zone* zone = zbd_->GetIOZone(extent.start_);
 
-    assert(zone && zone->used_capacity_ >= (*e)->length_);
-    zone->used_capacity_ -= (*e)->length_;
-    delete *e;
+    assert(zone && zone->used_capacity_ >= extent.length_);
+    zone->used_capacity_ -= extent.length_;
   }
   extents_.clear();
 }
 
 IOStatus ZoneFile::CloseActiveZone() {
   IOStatus s = IOStatus::OK();
-  if (active_zone_) {
+  if (active_zone_ && shared_zones_) {
+    /* Other files may still be writing to the zone */
+    s = zbd_->ReleaseSharedIOZone(active_zone_);
+    active_zone_ = nullptr;
+  } else if (active_zone_) {
     bool full = active_zone_->IsFull();
+    ZoneIOClass open_class = active_zone_->open_class_;
+    ZoneIOClass active_class = active_zone_->active_class_;
     s = active_zone_->Close();
     ReleaseActiveZone();
     if (!s.ok()) {
       return s;
     }
-    zbd_->PutOpenIOZoneToken();
+    zbd_->PutOpenIOZoneToken(open_class);
     if (full) {
-      zbd_->PutActiveIOZoneToken();
+      zbd_->PutActiveIOZoneToken(active_class);
     }
   }
   return s;
@@ -313,13 +386,14 @@ IOStatus ZoneFile::PersistMetadata() {
   return metadata_writer_->Persist(this);
 }
 
-ZoneExtent* ZoneFile::GetExtent(uint64_t file_offset, uint64_t* dev_offset) {
+const ZoneExtent* ZoneFile::GetExtent(uint64_t file_offset,
+                                      uint64_t* dev_offset) {
   for (unsigned int i = 0; i < extents_.size(); i++) {
-    if (file_offset < extents_[i]->length_) {
-      *dev_offset = extents_[i]->start_ + file_offset;
-      return extents_[i];
+    if (file_offset < extents_[i].length_) {
+      *dev_offset = extents_[i].start_ + file_offset;
+      return &extents_[i];
     } else {
-      file_offset -= extents_[i]->length_;
+      file_offset -= extents_[i].length_;
     }
   }
   return NULL;
@@ -333,14 +407,13 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
 
   ReadLock lck(this);
 
-  int f = zbd_->GetReadFD();
-  int f_direct = zbd_->GetReadDirectFD();
+  ZonedBlockDeviceBackend* zbd_be = zbd_->GetBackend();
   char* ptr;
   uint64_t r_off;
   size_t r_sz;
   ssize_t r = 0;
   size_t read = 0;
-  ZoneExtent* extent;
+  const ZoneExtent* extent;
   uint64_t extent_end;
   IOStatus s;
 
@@ -383,11 +456,7 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
       aligned = true;
     }
 
-    if (direct && aligned) {
-      r = pread(f_direct, ptr, pread_sz, r_off);
-    } else {
-      r = pread(f, ptr, pread_sz, r_off);
-    }
+    r = zbd_be->Read(ptr, pread_sz, r_off, direct && aligned);
 
     if (r <= 0) {
       if (r == -1 && errno == EINTR) {
@@ -428,6 +497,20 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
   return s;
 }
 
+void ZoneFile::AddExtent(uint64_t start, uint32_t length) {
+  /* Synced extents are in the metadata log already, and sparse extents are
+   * separated by their headers */
+  if (!is_sparse_ && extents_.size() > nr_synced_extents_) {
+    ZoneExtent& last = extents_.back();
+    if (last.start_ + last.length_ == start &&
+        zbd_->GetIOZone(last.start_) == zbd_->GetIOZone(start)) {
+      last.length_ += length;
+      return;
+    }
+  }
+  extents_.emplace_back(start, length);
+}
+
 void ZoneFile::PushExtent() {
   uint64_t length;
 
@@ -439,7 +522,7 @@ void ZoneFile::PushExtent() {
   if (length == 0) return;
 
   assert(length <= (active_zone_->wp_ - extent_start_));
-  extents_.push_back(new ZoneExtent(extent_start_, length, active_zone_));
+  AddExtent(extent_start_, length);
 
   active_zone_->used_capacity_ += length;
   extent_start_ = active_zone_->wp_;
@@ -448,13 +531,52 @@ void ZoneFile::PushExtent() {
 
 IOStatus ZoneFile::AllocateNewZone() {
   Zone* zone;
-  IOStatus s = zbd_->AllocateIOZone(lifetime_, io_type_, &zone);
+  uint64_t size_left = size_hint_ > file_size_ ? size_hint_ - file_size_ : 0;
+  uint64_t zone_capacity = zbd_->GetUsableZoneCapacity();
+  ZoneAllocMode mode = ZoneAllocMode::kDefault;
+
+  /* Small files, e.g. the last output of a compaction, would leave most of a
+   * dedicated zone unused, so they share zones with other files. */
+  if (dedicated_zones_ && 2 * size_left >= zone_capacity) {
+    mode = ZoneAllocMode::kDedicated;
+  } else if (io_type_ != IOType::kWAL) {
+    bool small = size_left > 0 &&
+                 size_left <= zone_capacity / ZENFS_SMALL_FILE_RATIO;
+    if (small_file_ || small) mode = ZoneAllocMode::kTail;
+  }
+
+  ZoneAllocContext ctx;
+  ctx.fname = GetFilename();
+  ctx.lifetime = placement_lifetime_;
+  ctx.write_hint = lifetime_;
+  ctx.io_type = io_type_;
+  ctx.placement_group = placement_group_;
+  /* A file larger than a zone is split anyway, so don't let the hint make
+   * every open zone look too small */
+  ctx.size_hint = std::min(size_left, zone_capacity);
+
+  IOStatus s;
+  if (shared_zones_ && mode == ZoneAllocMode::kDefault) {
+    s = zbd_->AllocateSharedIOZone(ctx, &zone, io_deadline_);
+  } else {
+    shared_zones_ = false;
+    s = zbd_->AllocateIOZone(ctx, &zone, mode, io_deadline_);
+  }
 
   if (!s.ok()) return s;
   if (!zone) {
     return IOStatus::NoSpace("Zone allocation failure\n");
   }
   SetActiveZone(zone);
+
+  /* Shared zones have no active extent, as the zone write pointer does not
+   * tell which of the data was written by this file. Every append is
+   * recorded in an extent of its own instead. */
+  if (shared_zones_) {
+    extent_start_ = NO_EXTENT;
+    extent_filepos_ = file_size_;
+    return IOStatus::OK();
+  }
   extent_start_ = active_zone_->wp_;
   extent_filepos_ = file_size_;
 
@@ -463,6 +585,13 @@ IOStatus ZoneFile::AllocateNewZone() {
   return PersistMetadata();
 }
 
+/* An append that fails after some of the data reached a zone can't be
+ * retried, as the data written would be appended again */
+static IOStatus AppendFailed(IOStatus s, bool written) {
+  if (written) s.SetRetryable(false);
+  return s;
+}
+
 /* Byte-aligned writes without a sparse header */
 IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
   uint32_t left = data_size;
@@ -470,6 +599,15 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
   uint32_t block_sz = GetBlockSize();
   IOStatus s;
 
+  if (shared_zones_) {
+    uint32_t align = data_size % block_sz;
+    uint32_t pad_sz = align ? block_sz - align : 0;
+
+    /* the buffer size s aligned on block size, so this is ok*/
+    if (pad_sz) memset(buffer + data_size, 0x0, pad_sz);
+    return SharedAppend(buffer, data_size, data_size + pad_sz);
+  }
+
   if (active_zone_ == NULL) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -491,10 +629,9 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
     uint64_t extent_length = wr_size;
 
     s = active_zone_->Append(buffer, wr_size + pad_sz);
-    if (!s.ok()) return s;
+    if (!s.ok()) return AppendFailed(s, left != data_size);
 
-    extents_.push_back(
-        new ZoneExtent(extent_start_, extent_length, active_zone_));
+    AddExtent(extent_start_, extent_length);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
@@ -504,13 +641,13 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
     if (active_zone_->capacity_ == 0) {
       s = CloseActiveZone();
       if (!s.ok()) {
-        return s;
+        return AppendFailed(s, left != data_size);
       }
       if (left) {
         memmove((void*)(buffer), (void*)(buffer + wr_size), left);
       }
       s = AllocateNewZone();
-      if (!s.ok()) return s;
+      if (!s.ok()) return AppendFailed(s, left != data_size);
     }
   }
 
@@ -548,11 +685,10 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
     EncodeFixed64(sparse_buffer, extent_length);
 
     s = active_zone_->Append(sparse_buffer, wr_size + pad_sz);
-    if (!s.ok()) return s;
+    if (!s.ok()) return AppendFailed(s, left != data_size);
 
-    extents_.push_back(
-        new ZoneExtent(extent_start_ + ZoneFile::SPARSE_HEADER_SIZE,
-                       extent_length, active_zone_));
+    extents_.emplace_back(extent_start_ + ZoneFile::SPARSE_HEADER_SIZE,
+                          extent_length);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
@@ -562,14 +698,14 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
     if (active_zone_->capacity_ == 0) {
       s = CloseActiveZone();
       if (!s.ok()) {
-        return s;
+        return AppendFailed(s, left != data_size);
       }
       if (left) {
         memmove((void*)(sparse_buffer + ZoneFile::SPARSE_HEADER_SIZE),
                 (void*)(sparse_buffer + wr_size), left);
       }
       s = AllocateNewZone();
-      if (!s.ok()) return s;
+      if (!s.ok()) return AppendFailed(s, left != data_size);
     }
   }
 
@@ -582,6 +718,8 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
   uint32_t wr_size, offset = 0;
   IOStatus s = IOStatus::OK();
 
+  if (shared_zones_) return SharedAppend((char*)data, data_size, data_size);
+
   if (!active_zone_) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -593,18 +731,18 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
 
       s = CloseActiveZone();
       if (!s.ok()) {
-        return s;
+        return AppendFailed(s, offset != 0);
       }
 
       s = AllocateNewZone();
-      if (!s.ok()) return s;
+      if (!s.ok()) return AppendFailed(s, offset != 0);
     }
 
     wr_size = left;
     if (wr_size > active_zone_->capacity_) wr_size = active_zone_->capacity_;
 
     s = active_zone_->Append((char*)data + offset, wr_size);
-    if (!s.ok()) return s;
+    if (!s.ok()) return AppendFailed(s, offset != 0);
 
     file_size_ += wr_size;
     left -= wr_size;
@@ -614,12 +752,52 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
   return IOStatus::OK();
 }
 
+/* Append through the sequencer of a zone shared with other files. The data
+ * is padded to a block aligned padded_size */
+IOStatus ZoneFile::SharedAppend(char* data, uint32_t size,
+                                uint32_t padded_size) {
+  uint32_t data_size = size;
+  IOStatus s;
+
+  while (size) {
+    uint32_t written;
+    uint64_t offset;
+
+    if (active_zone_ == nullptr) {
+      s = AllocateNewZone();
+      if (!s.ok()) return AppendFailed(s, size != data_size);
+    }
+
+    s = active_zone_->SequencedAppend(data, padded_size, &written, &offset);
+    if (!s.ok()) return AppendFailed(s, size != data_size);
+
+    uint32_t extent_length = std::min(written, size);
+    if (extent_length > 0) {
+      AddExtent(offset, extent_length);
+      active_zone_->used_capacity_ += extent_length;
+      file_size_ += extent_length;
+      extent_filepos_ = file_size_;
+    }
+
+    data += written;
+    size -= extent_length;
+    padded_size -= written;
+
+    /* The zone filled up, continue in another one */
+    if (size) {
+      s = CloseActiveZone();
+      if (!s.ok()) return AppendFailed(s, size != data_size);
+    }
+  }
+
+  return IOStatus::OK();
+}
+
 IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
                                         Zone* zone) {
   /* Sparse writes, we need to recover each individual segment */
   IOStatus s;
   uint32_t block_sz = GetBlockSize();
-  int f = zbd_->GetReadFD();
   uint64_t next_extent_start = start;
   char* buffer;
   int recovered_segments = 0;
@@ -633,7 +811,7 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
   while (next_extent_start < end) {
     uint64_t extent_length;
 
-    ret = pread(f, (void*)buffer, block_sz, next_extent_start);
+    ret = zbd_->Read(buffer, next_extent_start, block_sz, false);
     if (ret != (int)block_sz) {
       s = IOStatus::IOError("Unexpected read error while recovering");
       break;
@@ -647,8 +825,8 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
     recovered_segments++;
 
     zone->used_capacity_ += extent_length;
-    extents_.push_back(new ZoneExtent(next_extent_start + SPARSE_HEADER_SIZE,
-                                      extent_length, zone));
+    extents_.emplace_back(next_extent_start + SPARSE_HEADER_SIZE,
+                          extent_length);
 
     uint64_t extent_blocks = (extent_length + SPARSE_HEADER_SIZE) / block_sz;
     if ((extent_length + SPARSE_HEADER_SIZE) % block_sz) {
@@ -696,7 +874,7 @@ IOStatus ZoneFile::Recover() {
     /* For non-sparse files, the data is contigous and we can recover directly
        any missing data using the WP */
     zone->used_capacity_ += to_recover;
-    extents_.push_back(new ZoneExtent(extent_start_, to_recover, zone));
+    AddExtent(extent_start_, to_recover);
   }
 
   /* Mark up the file as having no missing extents */
@@ -705,29 +883,49 @@ IOStatus ZoneFile::Recover() {
   /* Recalculate file size */
   file_size_ = 0;
   for (uint32_t i = 0; i < extents_.size(); i++) {
-    file_size_ += extents_[i]->length_;
+    file_size_ += extents_[i].length_;
   }
 
   return IOStatus::OK();
 }
 
-void ZoneFile::ReplaceExtentList(std::vector<ZoneExtent*> new_list) {
+void ZoneFile::ReplaceExtentList(const std::vector<ZoneExtent>& new_list) {
   assert(!IsOpenForWR() && new_list.size() > 0);
-  assert(new_list.size() == extents_.size());
 
   WriteLock lck(this);
   extents_ = new_list;
 }
 
+std::vector<std::string> ZoneFile::GetLinkFiles() const {
+  std::vector<std::string> names;
+  for (const auto& link : linkfiles_) names.push_back(link.GetPath());
+  return names;
+}
+
+size_t ZoneFile::GetMemoryUsage() const {
+  size_t usage = sizeof(*this);
+
+  usage += extents_.capacity() * sizeof(ZoneExtent);
+  usage += linkfiles_.capacity() * sizeof(ZoneFileLink);
+  for (const auto& link : linkfiles_) usage += link.GetMemoryUsage();
+  return usage;
+}
+
 void ZoneFile::AddLinkName(const std::string& linkf) {
-  linkfiles_.push_back(linkf);
+  linkfiles_.emplace_back(linkf);
+}
+
+static std::vector<ZoneFileLink>::iterator FindLink(
+    std::vector<ZoneFileLink>& links, const std::string& path) {
+  return std::find_if(links.begin(), links.end(),
+                      [&](const ZoneFileLink& link) { return link.Is(path); });
 }
 
 IOStatus ZoneFile::RenameLink(const std::string& src, const std::string& dest) {
-  auto itr = std::find(linkfiles_.begin(), linkfiles_.end(), src);
+  auto itr = FindLink(linkfiles_, src);
   if (itr != linkfiles_.end()) {
     linkfiles_.erase(itr);
-    linkfiles_.push_back(dest);
+    linkfiles_.emplace_back(dest);
   } else {
     return IOStatus::IOError("RenameLink: Failed to find the linked file");
   }
@@ -736,7 +934,7 @@ IOStatus ZoneFile::RenameLink(const std::string& src, const std::string& dest) {
 
 IOStatus ZoneFile::RemoveLinkName(const std::string& linkf) {
   assert(GetNrLinks());
-  auto itr = std::find(linkfiles_.begin(), linkfiles_.end(), linkf);
+  auto itr = FindLink(linkfiles_, linkf);
   if (itr != linkfiles_.end()) {
     linkfiles_.erase(itr);
   } else {
@@ -747,9 +945,22 @@ IOStatus ZoneFile::RemoveLinkName(const std::string& linkf) {
 
 IOStatus ZoneFile::SetWriteLifeTimeHint(Env::WriteLifeTimeHint lifetime) {
   lifetime_ = lifetime;
+  placement_lifetime_ = lifetime;
   return IOStatus::OK();
 }
 
+void ZoneFile::PredictLifeTime() {
+  if (linkfiles_.empty()) return;
+  placement_lifetime_ = zbd_->GetLifetimePredictor().Predict(
+      GetFilename(), std::max(file_size_, size_hint_), lifetime_);
+}
+
+void ZoneFile::SetFileSizeHint(uint64_t size_hint) {
+  if (size_hint <= size_hint_) return;
+  size_hint_ = size_hint;
+  PredictLifeTime();
+}
+
 void ZoneFile::ReleaseActiveZone() {
   assert(active_zone_ != nullptr);
   bool ok = active_zone_->Release();
@@ -773,50 +984,155 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
   block_sz = zbd->GetBlockSize();
   zoneFile_ = zoneFile;
   buffer_pos = 0;
+  buffer_pool = zbd->GetWriteBufferPool();
+  pool_buffer = nullptr;
+  pool_buffer_sz = 0;
+  /* No sync seen yet, start with the largest buffer */
+  sync_sz_avg = WRITE_BUFFER_MAX_SIZE;
+  synced_wp = wp;
   sparse_buffer = nullptr;
   buffer = nullptr;
+  buffer_sz = 0;
+  writer_scheduled_ = false;
+  writer_room_ = 0;
 
-  if (buffered) {
-    if (zoneFile->IsSparse()) {
-      size_t sparse_buffer_sz;
+  open = true;
+}
 
-      sparse_buffer_sz =
-          1024 * 1024 + block_sz; /* one extra block size for padding */
-      int ret = posix_memalign((void**)&sparse_buffer, sysconf(_SC_PAGESIZE),
-                               sparse_buffer_sz);
+ZonedWritableFile::~ZonedWritableFile() {
+  IOStatus s = CloseInternal(ZONE_TOKEN_NO_DEADLINE);
+  /* The workers must be done with the file even if closing it failed */
+  WaitForWrites();
+  /* Data that could not be written is lost */
+  buffer_pos = 0;
+  PutBuffer();
 
-      if (ret) sparse_buffer = nullptr;
+  if (!s.ok()) {
+    zoneFile_->GetZbd()->SetZoneDeferredStatus(s);
+  }
+}
 
-      assert(sparse_buffer != nullptr);
+/* Must hold buffer_mtx_ */
+IOStatus ZonedWritableFile::GetBuffer() {
+  if (pool_buffer != nullptr) return IOStatus::OK();
 
-      buffer_sz = sparse_buffer_sz - ZoneFile::SPARSE_HEADER_SIZE - block_sz;
-      buffer = sparse_buffer + ZoneFile::SPARSE_HEADER_SIZE;
-    } else {
-      buffer_sz = 1024 * 1024;
-      int ret =
-          posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), buffer_sz);
+  /* Twice the average, so that most syncs fit a single buffer */
+  pool_buffer_sz = WriteBufferPool::SizeClass(2 * sync_sz_avg);
+  pool_buffer = buffer_pool->Get(pool_buffer_sz);
+  if (pool_buffer == nullptr)
+    return IOStatus::IOError("Failed to allocate a write buffer");
 
-      if (ret) buffer = nullptr;
-      assert(buffer != nullptr);
-    }
+  if (zoneFile_->IsSparse()) {
+    /* Room for the header, and one block for padding at the end */
+    sparse_buffer = pool_buffer;
+    buffer = sparse_buffer + ZoneFile::SPARSE_HEADER_SIZE;
+    buffer_sz = pool_buffer_sz - ZoneFile::SPARSE_HEADER_SIZE - block_sz;
+  } else {
+    buffer = pool_buffer;
+    buffer_sz = pool_buffer_sz;
   }
+  return IOStatus::OK();
+}
 
-  open = true;
+/* Must hold buffer_mtx_, returns the buffer if it is empty */
+void ZonedWritableFile::PutBuffer() {
+  if (pool_buffer == nullptr || buffer_pos != 0) return;
+
+  buffer_pool->Put(pool_buffer, pool_buffer_sz);
+  pool_buffer = nullptr;
+  sparse_buffer = nullptr;
+  buffer = nullptr;
+  buffer_sz = 0;
 }
 
-ZonedWritableFile::~ZonedWritableFile() {
-  IOStatus s = CloseInternal();
-  if (buffered) {
-    if (sparse_buffer != nullptr) {
-      free(sparse_buffer);
-    } else {
-      free(buffer);
-    }
+/* Must hold buffer_mtx_, hands the full buffer to the write behind workers
+ * and gets a new one. A buffer that may need a new zone is written here
+ * instead, so that zone token waits don't hold up the shared workers. */
+IOStatus ZonedWritableFile::QueueBuffer(const ZoneTokenDeadline& deadline) {
+  uint64_t write_sz = buffer_pos;
+  if (zoneFile_->IsSparse()) write_sz += ZoneFile::SPARSE_HEADER_SIZE;
+  write_sz = ((write_sz + block_sz - 1) / block_sz) * block_sz;
+
+  std::unique_lock<std::mutex> lock(writer_mtx_);
+  writer_cv_.wait(lock, [this] {
+    return pending_writes_.size() < ZENFS_WRITE_BEHIND_BUFFERS - 1;
+  });
+  if (!writer_status_.ok()) return writer_status_;
+
+  /* The zone can only be looked at while no worker writes the file */
+  if (pending_writes_.empty() && !writer_scheduled_)
+    writer_room_ = zoneFile_->GetActiveZoneRoom();
+
+  /* Filling the zone up closes it and allocates the next one */
+  if (write_sz >= writer_room_) {
+    writer_cv_.wait(lock, [this] {
+      return pending_writes_.empty() && !writer_scheduled_;
+    });
+    if (!writer_status_.ok()) return writer_status_;
+    lock.unlock();
+    zoneFile_->SetIODeadline(deadline);
+    return FlushBuffer();
   }
 
-  if (!s.ok()) {
-    zoneFile_->GetZbd()->SetZoneDeferredStatus(s);
+  writer_room_ -= write_sz;
+  pending_writes_.push_back({pool_buffer, pool_buffer_sz, buffer_pos});
+  bool schedule = !writer_scheduled_;
+  writer_scheduled_ = true;
+  lock.unlock();
+  if (schedule)
+    zoneFile_->GetZbd()->ScheduleWriteBehind(
+        GetZoneIOClass(zoneFile_->GetIOType(),
+                       zoneFile_->GetWriteLifeTimeHint()),
+        [this] { WriteQueuedBuffers(); });
+
+  pool_buffer = nullptr;
+  sparse_buffer = nullptr;
+  buffer = nullptr;
+  buffer_sz = 0;
+  buffer_pos = 0;
+  return GetBuffer();
+}
+
+IOStatus ZonedWritableFile::WaitForWrites() {
+  std::unique_lock<std::mutex> lock(writer_mtx_);
+  writer_cv_.wait(lock, [this] {
+    return pending_writes_.empty() && !writer_scheduled_;
+  });
+  return writer_status_;
+}
+
+/* Runs on a write behind worker */
+void ZonedWritableFile::WriteQueuedBuffers() {
+  std::unique_lock<std::mutex> lock(writer_mtx_);
+
+  while (!pending_writes_.empty()) {
+    PendingWrite write = pending_writes_.front();
+    bool failed = !writer_status_.ok();
+    lock.unlock();
+
+    IOStatus s;
+    if (!failed) {
+      if (zoneFile_->IsSparse()) {
+        s = zoneFile_->SparseAppend(write.pool_buffer, write.size);
+      } else {
+        s = zoneFile_->BufferedAppend(write.pool_buffer, write.size);
+      }
+      if (s.ok()) wp += write.size;
+    }
+    buffer_pool->Put(write.pool_buffer, write.pool_buffer_sz);
+
+    lock.lock();
+    if (!s.ok() && writer_status_.ok()) {
+      writer_status_ = s;
+      writer_status_.SetRetryable(false);
+    }
+    pending_writes_.pop_front();
+    writer_cv_.notify_all();
   }
+
+  /* Notify under the lock, the file may be gone once it is released */
+  writer_scheduled_ = false;
+  writer_cv_.notify_all();
 }
 
 MetadataWriter::~MetadataWriter() {}
@@ -824,16 +1140,30 @@ MetadataWriter::~MetadataWriter() {}
 IOStatus ZonedWritableFile::Truncate(uint64_t size,
                                      const IOOptions& /*options*/,
                                      IODebugContext* /*dbg*/) {
+  if (buffered) {
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    IOStatus s = WaitForWrites();
+    if (!s.ok()) return s;
+  }
   zoneFile_->SetFileSize(size);
   return IOStatus::OK();
 }
 
-IOStatus ZonedWritableFile::DataSync() {
+IOStatus ZonedWritableFile::DataSync(const ZoneTokenDeadline& deadline) {
   if (buffered) {
     IOStatus s;
     buffer_mtx_.lock();
     /* Flushing the buffer will result in a new extent added to the list*/
-    s = FlushBuffer();
+    s = WaitForWrites();
+    if (s.ok()) {
+      zoneFile_->SetIODeadline(deadline);
+      s = FlushBuffer();
+    }
+    if (s.ok()) {
+      sync_sz_avg = (3 * sync_sz_avg + (wp - synced_wp)) / 4;
+      synced_wp = wp;
+      PutBuffer();
+    }
     buffer_mtx_.unlock();
     if (!s.ok()) {
       return s;
@@ -847,12 +1177,15 @@ IOStatus ZonedWritableFile::DataSync() {
     /* For direct writes, there is no buffer to flush, we just need to push
        an extent for the latest written data */
     zoneFile_->PushExtent();
+    /* Shared zones can't be recovered from the write pointer, the appended
+     * extents must be persisted */
+    if (zoneFile_->IsSharedZones()) return zoneFile_->PersistMetadata();
   }
 
   return IOStatus::OK();
 }
 
-IOStatus ZonedWritableFile::Fsync(const IOOptions& /*options*/,
+IOStatus ZonedWritableFile::Fsync(const IOOptions& options,
                                   IODebugContext* /*dbg*/) {
   IOStatus s;
   ZenFSMetricsLatencyGuard guard(zoneFile_->GetZBDMetrics(),
@@ -862,7 +1195,7 @@ IOStatus ZonedWritableFile::Fsync(const IOOptions& /*options*/,
                                  Env::Default());
   zoneFile_->GetZBDMetrics()->ReportQPS(ZENFS_SYNC_QPS, 1);
 
-  s = DataSync();
+  s = DataSync(GetZoneTokenDeadline(options.timeout));
   if (!s.ok()) return s;
 
   /* As we've already synced the metadata in DataSync, no need to do it again */
@@ -871,9 +1204,9 @@ IOStatus ZonedWritableFile::Fsync(const IOOptions& /*options*/,
   return zoneFile_->PersistMetadata();
 }
 
-IOStatus ZonedWritableFile::Sync(const IOOptions& /*options*/,
+IOStatus ZonedWritableFile::Sync(const IOOptions& options,
                                  IODebugContext* /*dbg*/) {
-  return DataSync();
+  return DataSync(GetZoneTokenDeadline(options.timeout));
 }
 
 IOStatus ZonedWritableFile::Flush(const IOOptions& /*options*/,
@@ -882,24 +1215,25 @@ IOStatus ZonedWritableFile::Flush(const IOOptions& /*options*/,
 }
 
 IOStatus ZonedWritableFile::RangeSync(uint64_t offset, uint64_t nbytes,
-                                      const IOOptions& /*options*/,
+                                      const IOOptions& options,
                                       IODebugContext* /*dbg*/) {
-  if (wp < offset + nbytes) return DataSync();
+  if (wp < offset + nbytes)
+    return DataSync(GetZoneTokenDeadline(options.timeout));
 
   return IOStatus::OK();
 }
 
-IOStatus ZonedWritableFile::Close(const IOOptions& /*options*/,
+IOStatus ZonedWritableFile::Close(const IOOptions& options,
                                   IODebugContext* /*dbg*/) {
-  return CloseInternal();
+  return CloseInternal(GetZoneTokenDeadline(options.timeout));
 }
 
-IOStatus ZonedWritableFile::CloseInternal() {
+IOStatus ZonedWritableFile::CloseInternal(const ZoneTokenDeadline& deadline) {
   if (!open) {
     return IOStatus::OK();
   }
 
-  IOStatus s = DataSync();
+  IOStatus s = DataSync(deadline);
   if (!s.ok()) return s;
 
   s = zoneFile_->CloseWR();
@@ -930,17 +1264,21 @@ IOStatus ZonedWritableFile::FlushBuffer() {
   return IOStatus::OK();
 }
 
-IOStatus ZonedWritableFile::BufferedWrite(const Slice& slice) {
+IOStatus ZonedWritableFile::BufferedWrite(const Slice& slice,
+                                          const ZoneTokenDeadline& deadline) {
   uint32_t data_left = slice.size();
   char* data = (char*)slice.data();
   IOStatus s;
 
+  s = GetBuffer();
+  if (!s.ok()) return s;
+
   while (data_left) {
     uint32_t buffer_left = buffer_sz - buffer_pos;
     uint32_t to_buffer;
 
     if (!buffer_left) {
-      s = FlushBuffer();
+      s = QueueBuffer(deadline);
       if (!s.ok()) return s;
       buffer_left = buffer_sz;
     }
@@ -960,8 +1298,9 @@ IOStatus ZonedWritableFile::BufferedWrite(const Slice& slice) {
 }
 
 IOStatus ZonedWritableFile::Append(const Slice& data,
-                                   const IOOptions& /*options*/,
+                                   const IOOptions& options,
                                    IODebugContext* /*dbg*/) {
+  ZoneTokenDeadline deadline = GetZoneTokenDeadline(options.timeout);
   IOStatus s;
   ZenFSMetricsLatencyGuard guard(zoneFile_->GetZBDMetrics(),
                                  zoneFile_->GetIOType() == IOType::kWAL
@@ -974,9 +1313,10 @@ IOStatus ZonedWritableFile::Append(const Slice& data,
 
   if (buffered) {
     buffer_mtx_.lock();
-    s = BufferedWrite(data);
+    s = BufferedWrite(data, deadline);
     buffer_mtx_.unlock();
   } else {
+    zoneFile_->SetIODeadline(deadline);
     s = zoneFile_->Append((void*)data.data(), data.size());
     if (s.ok()) wp += data.size();
   }
@@ -985,8 +1325,9 @@ IOStatus ZonedWritableFile::Append(const Slice& data,
 }
 
 IOStatus ZonedWritableFile::PositionedAppend(const Slice& data, uint64_t offset,
-                                             const IOOptions& /*options*/,
+                                             const IOOptions& options,
                                              IODebugContext* /*dbg*/) {
+  ZoneTokenDeadline deadline = GetZoneTokenDeadline(options.timeout);
   IOStatus s;
   ZenFSMetricsLatencyGuard guard(zoneFile_->GetZBDMetrics(),
                                  zoneFile_->GetIOType() == IOType::kWAL
@@ -1004,9 +1345,10 @@ IOStatus ZonedWritableFile::PositionedAppend(const Slice& data, uint64_t offset,
 
   if (buffered) {
     buffer_mtx_.lock();
-    s = BufferedWrite(data);
+    s = BufferedWrite(data, deadline);
     buffer_mtx_.unlock();
   } else {
+    zoneFile_->SetIODeadline(deadline);
     s = zoneFile_->Append((void*)data.data(), data.size());
     if (s.ok()) wp += data.size();
   }
@@ -1016,6 +1358,20 @@ IOStatus ZonedWritableFile::PositionedAppend(const Slice& data, uint64_t offset,
 
 void ZonedWritableFile::SetWriteLifeTimeHint(Env::WriteLifeTimeHint hint) {
   zoneFile_->SetWriteLifeTimeHint(hint);
+  zoneFile_->PredictLifeTime();
+}
+
+void ZonedWritableFile::SetPreallocationBlockSize(size_t size) {
+  FSWritableFile::SetPreallocationBlockSize(size);
+  /* RocksDB sizes the preallocation block after the target file size */
+  zoneFile_->SetFileSizeHint(size);
+}
+
+IOStatus ZonedWritableFile::Allocate(uint64_t offset, uint64_t len,
+                                     const IOOptions& /*options*/,
+                                     IODebugContext* /*dbg*/) {
+  zoneFile_->SetFileSizeHint(offset + len);
+  return IOStatus::OK();
 }
 
 IOStatus ZonedSequentialFile::Read(size_t n, const IOOptions& /*options*/,
@@ -1056,16 +1412,14 @@ size_t ZoneFile::GetUniqueId(char* id, size_t max_size) {
     return 0;
   }
 
-  struct stat buf;
-  int fd = zbd_->GetReadFD();
-  int result = fstat(fd, &buf);
-  if (result == -1) {
+  uint64_t dev, ino;
+  if (!zbd_->GetBackend()->GetDeviceId(&dev, &ino)) {
     return 0;
   }
 
   char* rid = id;
-  rid = EncodeVarint64(rid, buf.st_dev);
-  rid = EncodeVarint64(rid, buf.st_ino);
+  rid = EncodeVarint64(rid, dev);
+  rid = EncodeVarint64(rid, ino);
   rid = EncodeVarint64(rid, file_id_);
   assert(rid >= id);
   return static_cast<size_t>(rid - id);
@@ -1110,6 +1464,51 @@ IOStatus ZoneFile::MigrateData(uint64_t offset, uint32_t length,
   return IOStatus::OK();
 }
 
+IOStatus ZoneFile::RewriteData(uint64_t offset, uint32_t length,
+                               Zone* target_zone, uint64_t* extent_start) {
+  const uint32_t step = 1 << 20;
+  uint32_t block_sz = GetBlockSize();
+  uint32_t header_sz = is_sparse_ ? SPARSE_HEADER_SIZE : 0;
+  uint32_t fill = header_sz;
+  uint32_t copied = 0;
+  IOStatus s;
+
+  if (header_sz + (uint64_t)length > target_zone->capacity_)
+    return IOStatus::NoSpace("Rewritten data does not fit the zone");
+
+  char* buf;
+  if (posix_memalign((void**)&buf, block_sz, step))
+    return IOStatus::IOError("failed allocating alignment write buffer\n");
+
+  *extent_start = target_zone->wp_ + header_sz;
+  if (is_sparse_) EncodeFixed64(buf, length);
+
+  while (copied < length) {
+    uint32_t n = std::min(length - copied, step - fill);
+    Slice result;
+
+    s = PositionedRead(offset + copied, n, &result, buf + fill, false);
+    if (!s.ok()) break;
+    if (result.size() != n) {
+      s = IOStatus::IOError("Short read while rewriting file data");
+      break;
+    }
+    fill += n;
+    copied += n;
+
+    if (fill == step || copied == length) {
+      uint32_t pad_sz = fill % block_sz ? block_sz - fill % block_sz : 0;
+      memset(buf + fill, 0, pad_sz);
+      s = target_zone->Append(buf, fill + pad_sz);
+      if (!s.ok()) break;
+      fill = 0;
+    }
+  }
+
+  free(buf);
+  return s;
+}
+
 size_t ZonedRandomAccessFile::GetUniqueId(char* id, size_t max_size) const {
   return zoneFile_->GetUniqueId(id, max_size);
 }
@@ -15,6 +15,8 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -27,16 +29,39 @@
 
 namespace ROCKSDB_NAMESPACE {
 
+/* A range of file data on the device. Extents are stored by value in the
+ * extent list of their file. An extent never crosses a zone boundary, so
+ * the length fits 32 bits and the zone is looked up from the start with
+ * ZonedBlockDevice::GetIOZone. */
 class ZoneExtent {
  public:
   uint64_t start_;
-  uint64_t length_;
-  Zone* zone_;
+  uint32_t length_;
 
-  explicit ZoneExtent(uint64_t start, uint64_t length, Zone* zone);
+  ZoneExtent() : start_(0), length_(0) {}
+  explicit ZoneExtent(uint64_t start, uint32_t length);
   Status DecodeFrom(Slice* input);
-  void EncodeTo(std::string* output);
-  void EncodeJson(std::ostream& json_stream);
+  void EncodeTo(std::string* output) const;
+  void EncodeJson(std::ostream& json_stream) const;
+};
+
+/* Heap memory used by a string, 0 if it fits in the small string buffer */
+size_t GetStringMemoryUsage(const std::string& str);
+
+/* Name of a link to a file. The files of a database share a directory,
+ * which is interned, so only the file name is kept per link. Names like
+ * 000123.sst fit in the small string buffer. */
+class ZoneFileLink {
+  const std::string* dir_;
+  std::string name_;
+
+ public:
+  explicit ZoneFileLink(const std::string& path);
+
+  std::string GetPath() const { return *dir_ + name_; }
+  bool Is(const std::string& path) const;
+  /* Heap memory used by the name, on top of the link itself */
+  size_t GetMemoryUsage() const;
 };
 
 class ZoneFile;
@@ -50,35 +75,53 @@ class MetadataWriter {
 
 class ZoneFile {
  private:
-  const uint64_t NO_EXTENT = 0xffffffffffffffff;
+  static constexpr uint64_t NO_EXTENT = 0xffffffffffffffff;
 
   ZonedBlockDevice* zbd_;
 
-  std::vector<ZoneExtent*> extents_;
-  std::vector<std::string> linkfiles_;
+  std::vector<ZoneExtent> extents_;
+  std::vector<ZoneFileLink> linkfiles_;
 
   Zone* active_zone_;
   uint64_t extent_start_ = NO_EXTENT;
   uint64_t extent_filepos_ = 0;
 
-  Env::WriteLifeTimeHint lifetime_;
-  IOType io_type_; /* Only used when writing */
   uint64_t file_size_;
+  /* Expected final size of the file, 0 if unknown */
+  uint64_t size_hint_ = 0;
+  /* Deadline for zone allocations of the ongoing write, only set by the
+   * thread appending to the file */
+  ZoneTokenDeadline io_deadline_ = ZONE_TOKEN_NO_DEADLINE;
   uint64_t file_id_;
-
-  uint32_t nr_synced_extents_ = 0;
-  bool open_for_wr_ = false;
-  std::mutex open_for_wr_mtx_;
-
   time_t m_time_;
-  bool is_sparse_ = false;
-  bool is_deleted_ = false;
+  /* 0 for files created before creation times were recorded */
+  time_t c_time_;
 
   MetadataWriter* metadata_writer_ = NULL;
 
+  std::mutex open_for_wr_mtx_;
   std::mutex writer_mtx_;
   std::atomic<int> readers_{0};
 
+  Env::WriteLifeTimeHint lifetime_;
+  /* Lifetime used for zone placement, predicted from observed deletions */
+  Env::WriteLifeTimeHint placement_lifetime_;
+  /* Can be changed by SetFilePlacementGroup while the file is written */
+  std::atomic<uint32_t> placement_group_{0};
+  uint32_t nr_synced_extents_ = 0;
+  IOType io_type_; /* Only used when writing */
+
+  /* Write zone sized files to zones of their own */
+  bool dedicated_zones_ = false;
+  /* Small file by type, packed into zone tails */
+  bool small_file_ = false;
+  /* Append to zones shared with other files through the zone write
+   * sequencer, every append gets an extent of its own */
+  bool shared_zones_ = false;
+  bool open_for_wr_ = false;
+  bool is_sparse_ = false;
+  bool is_deleted_ = false;
+
  public:
   static const int SPARSE_HEADER_SIZE = 8;
 
@@ -104,20 +147,44 @@ class ZoneFile {
   std::string GetFilename();
   time_t GetFileModificationTime();
   void SetFileModificationTime(time_t mt);
+  time_t GetFileCreationTime() { return c_time_; }
+  void SetFileCreationTime(time_t ct) { c_time_ = ct; }
   uint64_t GetFileSize();
   void SetFileSize(uint64_t sz);
   void ClearExtents();
 
   uint32_t GetBlockSize() { return zbd_->GetBlockSize(); }
   ZonedBlockDevice* GetZbd() { return zbd_; }
-  std::vector<ZoneExtent*> GetExtents() { return extents_; }
+  std::vector<ZoneExtent> GetExtents() { return extents_; }
   Env::WriteLifeTimeHint GetWriteLifeTimeHint() { return lifetime_; }
+  Env::WriteLifeTimeHint GetPlacementLifeTime() { return placement_lifetime_; }
+  void PredictLifeTime();
+  uint32_t GetPlacementGroup() { return placement_group_.load(); }
+  void SetPlacementGroup(uint32_t group) { placement_group_ = group; }
+  uint64_t GetFileSizeHint() { return size_hint_; }
+  void SetFileSizeHint(uint64_t size_hint);
+  /* Set from the IOOptions timeout of each write */
+  void SetIODeadline(const ZoneTokenDeadline& deadline) {
+    io_deadline_ = deadline;
+  }
+  void SetDedicatedZones(bool dedicated) { dedicated_zones_ = dedicated; }
+  void SetSmallFile(bool small_file) { small_file_ = small_file; }
+  bool IsSharedZones() { return shared_zones_; }
+  /* Bytes that can be appended without allocating a zone. Shared zones are
+   * allocated on every append, so they have none. */
+  uint64_t GetActiveZoneRoom() {
+    if (shared_zones_ || active_zone_ == nullptr) return 0;
+    return active_zone_->capacity_;
+  }
+  void SetSharedZones(bool shared) { shared_zones_ = shared; }
 
   IOStatus PositionedRead(uint64_t offset, size_t n, Slice* result,
                           char* scratch, bool direct);
-  ZoneExtent* GetExtent(uint64_t file_offset, uint64_t* dev_offset);
+  const ZoneExtent* GetExtent(uint64_t file_offset, uint64_t* dev_offset);
   void PushExtent();
   IOStatus AllocateNewZone();
+  /* Number of extents, see ZenFS::DefragmentFile */
+  size_t GetNrExtents() { return extents_.size(); }
 
   void EncodeTo(std::string* output, uint32_t extent_start);
   void EncodeUpdateTo(std::string* output) {
@@ -129,9 +196,17 @@ class ZoneFile {
   void MetadataUnsynced() { nr_synced_extents_ = 0; };
 
   IOStatus MigrateData(uint64_t offset, uint32_t length, Zone* target_zone);
+  /* Copy length bytes of file data from offset into a single extent at the
+   * write pointer of target_zone. The new extent starts at extent_start. */
+  IOStatus RewriteData(uint64_t offset, uint32_t length, Zone* target_zone,
+                       uint64_t* extent_start);
 
   Status DecodeFrom(Slice* input);
   Status MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace);
+  /* Meta data older versions don't know about, kept out of the file record.
+   * Decoding starts after the file ID. */
+  void EncodeFileMetaTo(std::string* output);
+  Status DecodeFileMetaFrom(Slice* input);
 
   uint64_t GetID() { return file_id_; }
   size_t GetUniqueId(char* id, size_t max_size);
@@ -144,17 +219,24 @@ class ZoneFile {
 
   IOStatus Recover();
 
-  void ReplaceExtentList(std::vector<ZoneExtent*> new_list);
+  void ReplaceExtentList(const std::vector<ZoneExtent>& new_list);
   void AddLinkName(const std::string& linkfile);
   IOStatus RemoveLinkName(const std::string& linkfile);
   IOStatus RenameLink(const std::string& src, const std::string& dest);
   uint32_t GetNrLinks() { return linkfiles_.size(); }
-  const std::vector<std::string>& GetLinkFiles() const { return linkfiles_; }
+  std::vector<std::string> GetLinkFiles() const;
+
+  /* Memory used by the file object, its extents and its link names */
+  size_t GetMemoryUsage() const;
 
  private:
   void ReleaseActiveZone();
   void SetActiveZone(Zone* zone);
   IOStatus CloseActiveZone();
+  IOStatus SharedAppend(char* data, uint32_t size, uint32_t padded_size);
+  /* Add an extent of data written since the last metadata sync, extending
+   * the last extent if the data follows it in the same zone */
+  void AddExtent(uint64_t start, uint32_t length);
 
  public:
   std::shared_ptr<ZenFSMetrics> GetZBDMetrics() { return zbd_->GetMetrics(); };
@@ -235,19 +317,38 @@ class ZonedWritableFile : public FSWritableFile {
     return zoneFile_->GetWriteLifeTimeHint();
   }
 
+  /* Preallocation is not possible on zoned storage, but the expected file
+   * size is used to pick a zone with enough capacity left */
+  void SetPreallocationBlockSize(size_t size) override;
+  IOStatus Allocate(uint64_t offset, uint64_t len, const IOOptions& options,
+                    IODebugContext* dbg) override;
+
  private:
-  IOStatus BufferedWrite(const Slice& data);
+  IOStatus BufferedWrite(const Slice& data,
+                         const ZoneTokenDeadline& deadline);
   IOStatus FlushBuffer();
-  IOStatus DataSync();
-  IOStatus CloseInternal();
+  IOStatus DataSync(const ZoneTokenDeadline& deadline);
+  IOStatus CloseInternal(const ZoneTokenDeadline& deadline);
+  IOStatus GetBuffer();
+  void PutBuffer();
+  IOStatus QueueBuffer(const ZoneTokenDeadline& deadline);
+  IOStatus WaitForWrites();
+  void WriteQueuedBuffers();
 
   bool buffered;
+  /* Buffer from the write buffer pool, held while it has unsynced data */
+  WriteBufferPool* buffer_pool;
+  char* pool_buffer;
+  size_t pool_buffer_sz;
+  /* Average data written between syncs, sizes the next buffer */
+  uint64_t sync_sz_avg;
+  uint64_t synced_wp;
   char* sparse_buffer;
   char* buffer;
   size_t buffer_sz;
   uint32_t block_sz;
   uint32_t buffer_pos;
-  uint64_t wp;
+  std::atomic<uint64_t> wp;
   int write_temp;
   bool open;
 
@@ -255,6 +356,28 @@ class ZonedWritableFile : public FSWritableFile {
   MetadataWriter* metadata_writer_;
 
   std::mutex buffer_mtx_;
+
+  /* Full buffers are written by the write behind workers of the device
+   * while the next one is filled. The workers only append to the active
+   * zone of the file, so they never wait for zone tokens. */
+  struct PendingWrite {
+    char* pool_buffer;
+    size_t pool_buffer_sz;
+    uint32_t size;
+  };
+  std::mutex writer_mtx_;
+  std::condition_variable writer_cv_;
+  /* Buffers not written yet, the first one is being written */
+  std::deque<PendingWrite> pending_writes_;
+  /* A worker is writing the pending buffers, at most one at a time so that
+   * they are written in order */
+  bool writer_scheduled_;
+  /* Room left in the active zone after the pending buffers are written */
+  uint64_t writer_room_;
+  /* First background write error, not retryable. The caller did not issue
+   * the failed write and the file has a hole, so all later writes and syncs
+   * fail. */
+  IOStatus writer_status_;
 };
 
 class ZonedSequentialFile : public FSSequentialFile {
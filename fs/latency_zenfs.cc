@@ -0,0 +1,213 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "latency_zenfs.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace ROCKSDB_NAMESPACE {
+
+IOStatus LoadZoneLatencyProfile(const std::string &filename,
+                                ZoneLatencyProfile *profile) {
+  std::ifstream file(filename);
+  std::string line;
+  uint64_t line_nr = 0;
+
+  if (!file.is_open())
+    return IOStatus::IOError("Failed to open latency profile " + filename);
+
+  while (std::getline(file, line)) {
+    line_nr++;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+
+    std::istringstream tokens(line);
+    std::string key, eq;
+    uint64_t val;
+    if (!(tokens >> key)) continue;
+    if (!(tokens >> eq >> val) || eq != "=")
+      return IOStatus::InvalidArgument("Malformed latency profile line " +
+                                       std::to_string(line_nr));
+
+    if (key == "parallel_units") {
+      profile->parallel_units = val;
+    } else if (key == "write_us") {
+      profile->write_us = val;
+    } else if (key == "write_us_per_mb") {
+      profile->write_us_per_mb = val;
+    } else if (key == "read_us") {
+      profile->read_us = val;
+    } else if (key == "read_us_per_mb") {
+      profile->read_us_per_mb = val;
+    } else if (key == "reset_us") {
+      profile->reset_us = val;
+    } else if (key == "finish_us") {
+      profile->finish_us = val;
+    } else if (key == "close_us") {
+      profile->close_us = val;
+    } else if (key == "read_write_interference_pct") {
+      profile->read_write_interference_pct = val;
+    } else {
+      return IOStatus::InvalidArgument("Unknown latency profile key: " + key);
+    }
+  }
+
+  if (profile->parallel_units == 0)
+    return IOStatus::InvalidArgument("parallel_units must be at least 1");
+
+  return IOStatus::OK();
+}
+
+static uint64_t TransferUs(uint64_t bytes, uint64_t us_per_mb) {
+  return (bytes * us_per_mb) >> 20;
+}
+
+/* Block until cost_us have passed since start */
+static void Charge(std::chrono::steady_clock::time_point start,
+                   uint64_t cost_us) {
+  std::this_thread::sleep_until(start + std::chrono::microseconds(cost_us));
+}
+
+LatencyModelBackend::LatencyModelBackend(
+    std::unique_ptr<ZonedBlockDeviceBackend> target,
+    const ZoneLatencyProfile &profile)
+    : target_(std::move(target)),
+      profile_(profile),
+      free_units_(profile.parallel_units) {}
+
+LatencyModelBackend::LatencyModelBackend(
+    std::unique_ptr<ZonedBlockDeviceBackend> target,
+    const std::string &profile_filename)
+    : target_(std::move(target)),
+      profile_filename_(profile_filename),
+      free_units_(profile_.parallel_units) {}
+
+IOStatus LatencyModelBackend::Open(bool readonly, bool exclusive) {
+  IOStatus s;
+
+  if (!profile_filename_.empty()) {
+    s = LoadZoneLatencyProfile(profile_filename_, &profile_);
+    if (!s.ok()) return s;
+    free_units_ = profile_.parallel_units;
+  }
+
+  s = target_->Open(readonly, exclusive);
+  if (!s.ok()) return s;
+
+  block_sz_ = target_->GetBlockSize();
+  zone_sz_ = target_->GetZoneSize();
+  nr_zones_ = target_->GetNrZones();
+  max_active_zones_ = target_->GetMaxActiveZones();
+  max_open_zones_ = target_->GetMaxOpenZones();
+
+  zone_mtxs_.clear();
+  for (uint32_t i = 0; i < nr_zones_; i++)
+    zone_mtxs_.emplace_back(new std::mutex());
+
+  return IOStatus::OK();
+}
+
+void LatencyModelBackend::GetUnit() {
+  std::unique_lock<std::mutex> lock(units_mtx_);
+  units_cv_.wait(lock, [this] { return free_units_ > 0; });
+  free_units_--;
+}
+
+void LatencyModelBackend::PutUnit() {
+  {
+    std::lock_guard<std::mutex> lock(units_mtx_);
+    free_units_++;
+  }
+  units_cv_.notify_one();
+}
+
+IOStatus LatencyModelBackend::ListZones(std::vector<ZoneInfo> *zones) {
+  return target_->ListZones(zones);
+}
+
+IOStatus LatencyModelBackend::ReportZones(uint64_t start, uint32_t nr_zones,
+                                          std::vector<ZoneInfo> *zones) {
+  return target_->ReportZones(start, nr_zones, zones);
+}
+
+IOStatus LatencyModelBackend::Reset(uint64_t start, uint32_t nr_zones) {
+  if (!IsZoneOffset(start) || !IsZoneOffset(start + (nr_zones - 1) * zone_sz_))
+    return target_->Reset(start, nr_zones);
+
+  /* Every zone of a range reset is charged */
+  std::vector<std::unique_lock<std::mutex>> locks;
+  for (uint32_t i = 0; i < nr_zones; i++)
+    locks.emplace_back(*ZoneMutex(start + i * zone_sz_));
+  GetUnit();
+  auto begin = std::chrono::steady_clock::now();
+  IOStatus s = target_->Reset(start, nr_zones);
+  Charge(begin, profile_.reset_us * nr_zones);
+  PutUnit();
+  return s;
+}
+
+IOStatus LatencyModelBackend::Finish(uint64_t start) {
+  if (!IsZoneOffset(start)) return target_->Finish(start);
+
+  std::lock_guard<std::mutex> lock(*ZoneMutex(start));
+  GetUnit();
+  auto begin = std::chrono::steady_clock::now();
+  IOStatus s = target_->Finish(start);
+  Charge(begin, profile_.finish_us);
+  PutUnit();
+  return s;
+}
+
+IOStatus LatencyModelBackend::Close(uint64_t start) {
+  if (!IsZoneOffset(start)) return target_->Close(start);
+
+  std::lock_guard<std::mutex> lock(*ZoneMutex(start));
+  GetUnit();
+  auto begin = std::chrono::steady_clock::now();
+  IOStatus s = target_->Close(start);
+  Charge(begin, profile_.close_us);
+  PutUnit();
+  return s;
+}
+
+int LatencyModelBackend::Read(char *buf, int size, uint64_t pos,
+                              bool direct) {
+  GetUnit();
+  auto begin = std::chrono::steady_clock::now();
+  uint64_t cost = profile_.read_us + TransferUs(size, profile_.read_us_per_mb);
+  cost += cost * profile_.read_write_interference_pct * writes_in_flight_ / 100;
+  int ret = target_->Read(buf, size, pos, direct);
+  Charge(begin, cost);
+  PutUnit();
+  return ret;
+}
+
+int LatencyModelBackend::Write(const char *data, uint32_t size,
+                               uint64_t pos) {
+  if (!IsZoneOffset(pos)) return target_->Write(data, size, pos);
+
+  std::lock_guard<std::mutex> lock(*ZoneMutex(pos));
+  GetUnit();
+  writes_in_flight_++;
+  auto begin = std::chrono::steady_clock::now();
+  int ret = target_->Write(data, size, pos);
+  Charge(begin,
+         profile_.write_us + TransferUs(size, profile_.write_us_per_mb));
+  writes_in_flight_--;
+  PutUnit();
+  return ret;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
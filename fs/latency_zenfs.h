@@ -0,0 +1,97 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "backend_zenfs.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Timing of a zoned device, all times in microseconds */
+struct ZoneLatencyProfile {
+  /* Operations the device services at the same time */
+  uint32_t parallel_units = 8;
+  /* Cost of a write, fixed plus per MB transferred. Writes to the same zone
+   * are serialized. */
+  uint64_t write_us = 15;
+  uint64_t write_us_per_mb = 1000;
+  uint64_t read_us = 80;
+  uint64_t read_us_per_mb = 300;
+  uint64_t reset_us = 5000;
+  uint64_t finish_us = 1000;
+  uint64_t close_us = 50;
+  /* Reads are slowed down by this percentage of their cost for every write
+   * in flight */
+  uint32_t read_write_interference_pct = 25;
+};
+
+/* Load a profile from a file of key = value lines, '#' starts a comment.
+ * The keys are the names of the ZoneLatencyProfile fields, fields that are
+ * not in the file keep their defaults. */
+IOStatus LoadZoneLatencyProfile(const std::string &filename,
+                                ZoneLatencyProfile *profile);
+
+/* Delays the operations of another backend by a model of the device timing
+ *
+ * Meant for emulated devices, to benchmark scheduling and allocation changes
+ * with realistic latencies. Every zone operation, write and read is charged,
+ * and the caller is blocked until the modeled completion time.
+ */
+class LatencyModelBackend : public ZonedBlockDeviceBackend {
+ private:
+  std::unique_ptr<ZonedBlockDeviceBackend> target_;
+  std::string profile_filename_;
+  ZoneLatencyProfile profile_;
+
+  std::mutex units_mtx_;
+  std::condition_variable units_cv_;
+  uint32_t free_units_;
+  std::atomic<uint32_t> writes_in_flight_{0};
+  std::vector<std::unique_ptr<std::mutex>> zone_mtxs_;
+
+  void GetUnit();
+  void PutUnit();
+  bool IsZoneOffset(uint64_t pos) { return pos / zone_sz_ < nr_zones_; }
+  std::mutex *ZoneMutex(uint64_t pos) {
+    return zone_mtxs_[pos / zone_sz_].get();
+  }
+
+ public:
+  LatencyModelBackend(std::unique_ptr<ZonedBlockDeviceBackend> target,
+                      const ZoneLatencyProfile &profile);
+  /* The profile is loaded from the file on Open */
+  LatencyModelBackend(std::unique_ptr<ZonedBlockDeviceBackend> target,
+                      const std::string &profile_filename);
+  ~LatencyModelBackend() {}
+
+  IOStatus Open(bool readonly, bool exclusive) override;
+  IOStatus ListZones(std::vector<ZoneInfo> *zones) override;
+  IOStatus ReportZones(uint64_t start, uint32_t nr_zones,
+                       std::vector<ZoneInfo> *zones) override;
+  IOStatus Reset(uint64_t start, uint32_t nr_zones) override;
+  IOStatus Finish(uint64_t start) override;
+  IOStatus Close(uint64_t start) override;
+  int Read(char *buf, int size, uint64_t pos, bool direct) override;
+  int Write(const char *data, uint32_t size, uint64_t pos) override;
+  bool GetDeviceId(uint64_t *dev, uint64_t *ino) override {
+    return target_->GetDeviceId(dev, ino);
+  }
+  std::string GetFilename() override { return target_->GetFilename(); }
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
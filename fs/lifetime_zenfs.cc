@@ -0,0 +1,138 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "lifetime_zenfs.h"
+
+#include <string>
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Upper lifetime bucket (log2 seconds) of each predicted hint */
+#define LIFETIME_BUCKET_SHORT (6)    /* ~1 minute */
+#define LIFETIME_BUCKET_MEDIUM (10)  /* ~17 minutes */
+#define LIFETIME_BUCKET_LONG (14)    /* ~4.5 hours */
+
+void LifetimePredictor::LifetimeHistogram::Add(uint64_t lifetime_s) {
+  int bucket = 0;
+
+  while (lifetime_s && bucket < kNrBuckets - 1) {
+    lifetime_s >>= 1;
+    bucket++;
+  }
+
+  if (count >= kMaxSamples) {
+    count = 0;
+    for (int i = 0; i < kNrBuckets; i++) {
+      buckets[i] /= 2;
+      count += buckets[i];
+    }
+  }
+
+  buckets[bucket]++;
+  count++;
+}
+
+int LifetimePredictor::LifetimeHistogram::MedianBucket() {
+  uint64_t seen = 0;
+
+  for (int i = 0; i < kNrBuckets; i++) {
+    seen += buckets[i];
+    if (2 * seen >= count) return i;
+  }
+  return kNrBuckets - 1;
+}
+
+static bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/* A fixed set of types, so that odd names like rotated info logs or temp
+ * files do not add classes without bound */
+std::string LifetimePredictor::GetFileType(const std::string& fname) {
+  std::string basename = fname.substr(fname.find_last_of('/') + 1);
+
+  if (basename.rfind("MANIFEST", 0) == 0) return "MANIFEST";
+  if (EndsWith(basename, ".sst")) return "sst";
+  if (EndsWith(basename, ".log")) return "log";
+  if (EndsWith(basename, ".blob")) return "blob";
+  return "other";
+}
+
+int LifetimePredictor::GetSizeBucket(uint64_t size) {
+  uint64_t mb = size >> 20;
+  int bucket = 1;
+
+  if (size == 0) return 0;
+
+  while (mb && bucket < kNrSizeBuckets - 1) {
+    mb >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+Env::WriteLifeTimeHint LifetimePredictor::BucketToLifetime(int bucket) {
+  if (bucket <= LIFETIME_BUCKET_SHORT) return Env::WLTH_SHORT;
+  if (bucket <= LIFETIME_BUCKET_MEDIUM) return Env::WLTH_MEDIUM;
+  if (bucket <= LIFETIME_BUCKET_LONG) return Env::WLTH_LONG;
+  return Env::WLTH_EXTREME;
+}
+
+void LifetimePredictor::RecordDeletion(const std::string& fname, uint64_t size,
+                                       Env::WriteLifeTimeHint hint,
+                                       uint64_t lifetime_s) {
+  std::string type = GetFileType(fname);
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  /* Track both the exact size bucket and the any-size class, the latter is
+   * used when the size of a new file is not known */
+  histograms_[FileClass{type, GetSizeBucket(size), hint}].Add(lifetime_s);
+  histograms_[FileClass{type, 0, hint}].Add(lifetime_s);
+}
+
+Env::WriteLifeTimeHint LifetimePredictor::Predict(const std::string& fname,
+                                                  uint64_t size,
+                                                  Env::WriteLifeTimeHint hint) {
+  std::string type = GetFileType(fname);
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  for (int size_bucket : {GetSizeBucket(size), 0}) {
+    auto it = histograms_.find(FileClass{type, size_bucket, hint});
+    if (it != histograms_.end() && it->second.count >= kMinSamples)
+      return BucketToLifetime(it->second.MedianBucket());
+  }
+
+  return hint;
+}
+
+void LifetimePredictor::EncodeJson(std::ostream& json_stream) {
+  bool first_element = true;
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  json_stream << "[";
+  for (auto& it : histograms_) {
+    if (first_element) {
+      first_element = false;
+    } else {
+      json_stream << ",";
+    }
+    json_stream << "{";
+    json_stream << "\"type\":\"" << it.first.type << "\",";
+    json_stream << "\"size_bucket\":" << it.first.size_bucket << ",";
+    json_stream << "\"hint\":" << it.first.hint << ",";
+    json_stream << "\"count\":" << it.second.count << ",";
+    json_stream << "\"median_bucket\":" << it.second.MedianBucket();
+    json_stream << "}";
+  }
+  json_stream << "]";
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,86 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "rocksdb/env.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Learns file lifetimes from observed deletions
+ *
+ * Files are classified by type (sst, log, blob, MANIFEST or other), size
+ * bucket and the write life time hint passed by RocksDB. For each class an
+ * online histogram of lifetimes (log2 seconds) is kept, where the lifetime of
+ * a file is the time from its creation until it is deleted.
+ *
+ * Once a class has seen enough deletions, the median lifetime of the class is
+ * mapped to the write life time hint used for zone placement, so that files
+ * that die together end up in the same zones.
+ */
+class LifetimePredictor {
+ public:
+  static const int kNrBuckets = 32;
+  static const int kNrSizeBuckets = 16;
+  /* Deletions needed before a class prediction is trusted */
+  static const uint64_t kMinSamples = 16;
+  /* Halve the histogram when reaching this many samples to follow changes in
+   * the workload */
+  static const uint64_t kMaxSamples = 4096;
+
+  /* Record the deletion of a file that lived for lifetime_s seconds */
+  void RecordDeletion(const std::string& fname, uint64_t size,
+                      Env::WriteLifeTimeHint hint, uint64_t lifetime_s);
+
+  /* Predict the lifetime hint to place a file by. size may be zero if the
+   * file size is not known yet. Returns hint if there is no confident
+   * prediction. */
+  Env::WriteLifeTimeHint Predict(const std::string& fname, uint64_t size,
+                                 Env::WriteLifeTimeHint hint);
+
+  void EncodeJson(std::ostream& json_stream);
+
+ private:
+  struct FileClass {
+    std::string type;
+    int size_bucket; /* 0: any size */
+    Env::WriteLifeTimeHint hint;
+
+    bool operator<(const FileClass& other) const {
+      if (type != other.type) return type < other.type;
+      if (size_bucket != other.size_bucket)
+        return size_bucket < other.size_bucket;
+      return hint < other.hint;
+    }
+  };
+
+  struct LifetimeHistogram {
+    uint64_t count = 0;
+    uint64_t buckets[kNrBuckets] = {0};
+
+    void Add(uint64_t lifetime_s);
+    int MedianBucket();
+  };
+
+  static std::string GetFileType(const std::string& fname);
+  static int GetSizeBucket(uint64_t size);
+  static Env::WriteLifeTimeHint BucketToLifetime(int bucket);
+
+  std::mutex mtx_;
+  std::map<FileClass, LifetimeHistogram> histograms_;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
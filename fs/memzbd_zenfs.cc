@@ -0,0 +1,140 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "memzbd_zenfs.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Contents of the named devices that are not open */
+struct MemZonedImage {
+  bool in_use = false;
+  MemZonedOptions options;
+  std::vector<EmulatedZonedBackend::EmulatedZone> zones;
+  std::vector<std::string> data;
+};
+
+static std::mutex mem_devices_mtx;
+static std::map<std::string, MemZonedImage> mem_devices;
+
+MemZonedBackend::MemZonedBackend(const MemZonedOptions &options)
+    : EmulatedZonedBackend(options),
+      nr_stored_zones_(options.nr_stored_zones) {}
+
+MemZonedBackend::MemZonedBackend(const std::string &name,
+                                 const std::string &options)
+    : EmulatedZonedBackend(options), name_(name), nr_stored_zones_(0) {}
+
+MemZonedBackend::~MemZonedBackend() {
+  if (name_.empty() || zones_.empty()) return;
+
+  std::lock_guard<std::mutex> lock(mem_devices_mtx);
+  MemZonedImage &image = mem_devices[name_];
+  image.zones = std::move(zones_);
+  image.data = std::move(data_);
+  image.in_use = false;
+}
+
+IOStatus MemZonedBackend::Open(bool /*readonly*/, bool /*exclusive*/) {
+  std::lock_guard<std::mutex> lock(zone_mtx_);
+
+  if (name_.empty()) {
+    IOStatus s = InitZones();
+    if (s.ok()) data_.assign(nr_zones_, std::string());
+    return s;
+  }
+
+  std::lock_guard<std::mutex> devices_lock(mem_devices_mtx);
+  auto it = mem_devices.find(name_);
+  if (it == mem_devices.end()) {
+    IOStatus s = InitZones();
+    if (!s.ok()) return s;
+    data_.assign(nr_zones_, std::string());
+
+    MemZonedImage &image = mem_devices[name_];
+    image.options = MemZonedOptions(options_);
+    image.options.nr_stored_zones = nr_stored_zones_;
+    image.in_use = true;
+    return IOStatus::OK();
+  }
+
+  MemZonedImage &image = it->second;
+  if (image.in_use)
+    return IOStatus::Busy("Emulated device in use: " + name_);
+
+  /* The device keeps the geometry it was created with */
+  options_ = image.options;
+  nr_stored_zones_ = image.options.nr_stored_zones;
+  IOStatus s = InitZones(image.zones);
+  if (!s.ok()) return s;
+  data_ = std::move(image.data);
+  image.in_use = true;
+
+  return IOStatus::OK();
+}
+
+int MemZonedBackend::ReadData(char *buf, int size, uint64_t pos) {
+  int read = 0;
+
+  while (read < size) {
+    uint32_t idx = pos / zone_sz_;
+    uint64_t zone_off = pos - ZoneStart(idx);
+    uint64_t n = std::min((uint64_t)(size - read), zone_sz_ - zone_off);
+    const std::string &data = data_[idx];
+
+    /* Unwritten and unstored blocks read as zeros */
+    uint64_t stored = 0;
+    if (zone_off < data.size()) {
+      stored = std::min(n, (uint64_t)data.size() - zone_off);
+      memcpy(buf + read, data.data() + zone_off, stored);
+    }
+    memset(buf + read + stored, 0, n - stored);
+
+    read += n;
+    pos += n;
+  }
+
+  return read;
+}
+
+int MemZonedBackend::WriteData(const char *data, uint32_t size,
+                               uint64_t pos) {
+  uint32_t idx = pos / zone_sz_;
+
+  if (nr_stored_zones_ == 0 || idx < nr_stored_zones_)
+    data_[idx].append(data, size);
+
+  return size;
+}
+
+IOStatus MemZonedBackend::DiscardZone(uint32_t idx) {
+  std::string().swap(data_[idx]);
+  return IOStatus::OK();
+}
+
+bool MemZonedBackend::GetDeviceId(uint64_t *dev, uint64_t *ino) {
+  /* Named devices keep their id between opens */
+  *dev = 0;
+  if (name_.empty())
+    *ino = (uint64_t)this;
+  else
+    *ino = std::hash<std::string>()(name_);
+  return true;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
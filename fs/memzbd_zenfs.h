@@ -0,0 +1,63 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <string>
+#include <vector>
+
+#include "emuzbd_zenfs.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct MemZonedOptions : public EmulatedZoneOptions {
+  MemZonedOptions() {}
+  explicit MemZonedOptions(const EmulatedZoneOptions &options)
+      : EmulatedZoneOptions(options) {}
+
+  /* Only the data of the first nr_stored_zones zones is kept in memory,
+   * reads from the other zones return zeros. 0 keeps the data of all zones.
+   * Keeping the metadata zones is enough to mount the file system. */
+  uint32_t nr_stored_zones = 0;
+};
+
+/* Zoned block device emulated in memory
+ *
+ * An anonymous device starts out empty on every open. A named device keeps
+ * its zones and data between opens, until the process exits, so that a file
+ * system created on it can be mounted again. A named device can only be open
+ * once at a time.
+ */
+class MemZonedBackend : public EmulatedZonedBackend {
+ private:
+  std::string name_;
+  uint32_t nr_stored_zones_;
+  std::vector<std::string> data_;
+
+ protected:
+  int ReadData(char *buf, int size, uint64_t pos) override;
+  int WriteData(const char *data, uint32_t size, uint64_t pos) override;
+  IOStatus DiscardZone(uint32_t idx) override;
+
+ public:
+  explicit MemZonedBackend(const MemZonedOptions &options);
+  /* Named device, see ParseEmulatedZoneOptions for the options */
+  MemZonedBackend(const std::string &name, const std::string &options);
+  ~MemZonedBackend();
+
+  IOStatus Open(bool readonly, bool exclusive) override;
+  bool GetDeviceId(uint64_t *dev, uint64_t *ino) override;
+  std::string GetFilename() override {
+    return name_.empty() ? "mem" : "mem:" + name_;
+  }
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
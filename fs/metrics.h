@@ -94,6 +94,30 @@ enum ZenFSMetricsHistograms : uint32_t {
   ZENFS_ZONE_WRITE_LATENCY,
 
   ZENFS_L0_IO_ALLOC_LATENCY,
+
+  // Zone token wait latencies, one per ZoneIOClass in class order
+  ZENFS_WAL_ZONE_TOKEN_WAIT_LATENCY,
+  ZENFS_FLUSH_ZONE_TOKEN_WAIT_LATENCY,
+  ZENFS_SHALLOW_COMPACTION_ZONE_TOKEN_WAIT_LATENCY,
+  ZENFS_DEEP_COMPACTION_ZONE_TOKEN_WAIT_LATENCY,
+  ZENFS_GC_ZONE_TOKEN_WAIT_LATENCY,
+
+  // Zone token waits that had to block, and waits that timed out
+  ZENFS_WAL_ZONE_TOKEN_WAIT_QPS,
+  ZENFS_FLUSH_ZONE_TOKEN_WAIT_QPS,
+  ZENFS_SHALLOW_COMPACTION_ZONE_TOKEN_WAIT_QPS,
+  ZENFS_DEEP_COMPACTION_ZONE_TOKEN_WAIT_QPS,
+  ZENFS_GC_ZONE_TOKEN_WAIT_QPS,
+
+  ZENFS_WAL_ZONE_TOKEN_TIMEOUT_QPS,
+  ZENFS_FLUSH_ZONE_TOKEN_TIMEOUT_QPS,
+  ZENFS_SHALLOW_COMPACTION_ZONE_TOKEN_TIMEOUT_QPS,
+  ZENFS_DEEP_COMPACTION_ZONE_TOKEN_TIMEOUT_QPS,
+  ZENFS_GC_ZONE_TOKEN_TIMEOUT_QPS,
+
+  // Average memory used per file by the file objects, extents, names and
+  // file map entries
+  ZENFS_FILE_MEMORY_SIZE,
 };
 
 struct ZenFSMetrics {
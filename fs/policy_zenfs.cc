@@ -0,0 +1,127 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "policy_zenfs.h"
+
+#include <assert.h>
+
+#include <map>
+#include <mutex>
+
+#include "zbd_zenfs.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
+                             Env::WriteLifeTimeHint file_lifetime) {
+  assert(file_lifetime <= Env::WLTH_EXTREME);
+
+  if ((file_lifetime == Env::WLTH_NOT_SET) ||
+      (file_lifetime == Env::WLTH_NONE)) {
+    if (file_lifetime == zone_lifetime) {
+      return 0;
+    } else {
+      return LIFETIME_DIFF_NOT_GOOD;
+    }
+  }
+
+  if (zone_lifetime > file_lifetime) return zone_lifetime - file_lifetime;
+  if (zone_lifetime == file_lifetime) return LIFETIME_DIFF_COULD_BE_WORSE;
+
+  return LIFETIME_DIFF_NOT_GOOD;
+}
+
+/* FIFO groups never share zones and fill them in creation order */
+static bool IsFIFOMismatch(Zone* zone, uint32_t placement_group) {
+  if (!((zone->placement_group_ | placement_group) & FIFO_PLACEMENT_GROUP))
+    return false;
+  return zone->placement_group_ != placement_group;
+}
+
+const char* DefaultZoneAllocationPolicy::kName = "default";
+
+unsigned int DefaultZoneAllocationPolicy::GetPlacementDiff(
+    Zone* zone, const ZoneAllocContext& ctx) {
+  if (IsFIFOMismatch(zone, ctx.placement_group)) return LIFETIME_DIFF_NOT_GOOD;
+  if (ctx.placement_group & FIFO_PLACEMENT_GROUP) return 0;
+
+  unsigned int diff = GetLifeTimeDiff(zone->lifetime_, ctx.lifetime);
+
+  /* Only mix placement groups if we can't open a new zone */
+  if (zone->placement_group_ != ctx.placement_group &&
+      diff < LIFETIME_DIFF_OTHER_GROUP)
+    diff = LIFETIME_DIFF_OTHER_GROUP;
+
+  /* Rather open a new zone than split the file over this one */
+  if (zone->capacity_ < ctx.size_hint && diff < LIFETIME_DIFF_COULD_BE_WORSE)
+    diff = LIFETIME_DIFF_COULD_BE_WORSE;
+
+  return diff;
+}
+
+const char* GreedyZoneAllocationPolicy::kName = "greedy";
+
+unsigned int GreedyZoneAllocationPolicy::GetPlacementDiff(
+    Zone* zone, const ZoneAllocContext& ctx) {
+  if (IsFIFOMismatch(zone, ctx.placement_group)) return LIFETIME_DIFF_NOT_GOOD;
+  if (ctx.placement_group & FIFO_PLACEMENT_GROUP) return 0;
+
+  if (zone->capacity_ < ctx.size_hint) return LIFETIME_DIFF_COULD_BE_WORSE;
+
+  unsigned int diff = zone->lifetime_ > ctx.lifetime
+                          ? zone->lifetime_ - ctx.lifetime
+                          : ctx.lifetime - zone->lifetime_;
+  if (zone->placement_group_ != ctx.placement_group)
+    diff += Env::WLTH_EXTREME + 1;
+
+  return diff;
+}
+
+static std::mutex& PolicyRegistryMutex() {
+  static std::mutex mtx;
+  return mtx;
+}
+
+static std::map<std::string, ZoneAllocationPolicyFactory>& PolicyRegistry() {
+  static std::map<std::string, ZoneAllocationPolicyFactory> registry = {
+      {DefaultZoneAllocationPolicy::kName,
+       [] { return new DefaultZoneAllocationPolicy(); }},
+      {GreedyZoneAllocationPolicy::kName,
+       [] { return new GreedyZoneAllocationPolicy(); }},
+  };
+  return registry;
+}
+
+void RegisterZoneAllocationPolicy(const std::string& name,
+                                  ZoneAllocationPolicyFactory factory) {
+  std::lock_guard<std::mutex> lock(PolicyRegistryMutex());
+  PolicyRegistry()[name] = factory;
+}
+
+Status NewZoneAllocationPolicy(const std::string& name,
+                               std::shared_ptr<ZoneAllocationPolicy>* policy) {
+  std::lock_guard<std::mutex> lock(PolicyRegistryMutex());
+  auto it = PolicyRegistry().find(name);
+
+  if (it == PolicyRegistry().end())
+    return Status::NotFound("No zone allocation policy named " + name);
+  policy->reset(it->second());
+  return Status::OK();
+}
+
+std::vector<std::string> GetZoneAllocationPolicyNames() {
+  std::lock_guard<std::mutex> lock(PolicyRegistryMutex());
+  std::vector<std::string> names;
+
+  for (const auto& it : PolicyRegistry()) names.push_back(it.first);
+  return names;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
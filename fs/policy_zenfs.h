@@ -0,0 +1,100 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+#define LIFETIME_DIFF_NOT_GOOD (100)
+#define LIFETIME_DIFF_COULD_BE_WORSE (50)
+/* Worse than any lifetime match within the placement group, but still
+ * better than finishing a zone to open a new one */
+#define LIFETIME_DIFF_OTHER_GROUP (LIFETIME_DIFF_COULD_BE_WORSE + 1)
+
+unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
+                             Env::WriteLifeTimeHint file_lifetime);
+
+class Zone;
+
+/* What the allocator knows about the file it places */
+struct ZoneAllocContext {
+  std::string fname;
+  /* Predicted lifetime the file is placed by */
+  Env::WriteLifeTimeHint lifetime = Env::WLTH_NOT_SET;
+  /* Lifetime hint set by RocksDB, which tells the kind of write */
+  Env::WriteLifeTimeHint write_hint = Env::WLTH_NOT_SET;
+  IOType io_type = IOType::kUnknown;
+  uint32_t placement_group = 0;
+  /* Expected amount of data still to be written, capped at the usable zone
+   * capacity, 0 if unknown */
+  uint64_t size_hint = 0;
+};
+
+/* Decides which open zone a file is appended to
+ *
+ * The allocator asks the policy for the placement cost of every open zone
+ * and picks the cheapest one. Below LIFETIME_DIFF_COULD_BE_WORSE the zone is
+ * used right away, below LIFETIME_DIFF_NOT_GOOD it is used only if no new
+ * zone can be opened without finishing another one, and zones costing
+ * LIFETIME_DIFF_NOT_GOOD or more are never used. Token handling, finishing
+ * zones and opening new zones stay with the allocator.
+ *
+ * Policies are looked up by name, so that they can be picked with the
+ * policy option of the zenfs:// URI or ZenFS::SetAllocationPolicy.
+ */
+class ZoneAllocationPolicy {
+ public:
+  virtual ~ZoneAllocationPolicy() {}
+
+  virtual const char* Name() const = 0;
+  /* Called with the zone acquired */
+  virtual unsigned int GetPlacementDiff(Zone* zone,
+                                        const ZoneAllocContext& ctx) = 0;
+};
+
+/* Place files by lifetime hint and placement group, the ZenFS default */
+class DefaultZoneAllocationPolicy : public ZoneAllocationPolicy {
+ public:
+  static const char* kName;
+  const char* Name() const override { return kName; }
+  unsigned int GetPlacementDiff(Zone* zone,
+                                const ZoneAllocContext& ctx) override;
+};
+
+/* Fill open zones before opening new ones, preferring close lifetimes.
+ * Keeps few zones active at the cost of mixing lifetimes. */
+class GreedyZoneAllocationPolicy : public ZoneAllocationPolicy {
+ public:
+  static const char* kName;
+  const char* Name() const override { return kName; }
+  unsigned int GetPlacementDiff(Zone* zone,
+                                const ZoneAllocContext& ctx) override;
+};
+
+using ZoneAllocationPolicyFactory = std::function<ZoneAllocationPolicy*()>;
+
+/* Make a policy available by name, replacing any policy of the same name */
+void RegisterZoneAllocationPolicy(const std::string& name,
+                                  ZoneAllocationPolicyFactory factory);
+Status NewZoneAllocationPolicy(const std::string& name,
+                               std::shared_ptr<ZoneAllocationPolicy>* policy);
+std::vector<std::string> GetZoneAllocationPolicyNames();
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
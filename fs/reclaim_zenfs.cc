@@ -0,0 +1,152 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "reclaim_zenfs.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rocksdb/env.h"
+#include "rocksdb/metadata.h"
+#include "rocksdb/options.h"
+#include "snapshot.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+static std::string FileBasename(const std::string& path) {
+  size_t pos = path.find_last_of('/');
+  if (pos == std::string::npos) return path;
+  return path.substr(pos + 1);
+}
+
+ZenFSReclaimListener::ZenFSReclaimListener(ZenFS* zenfs,
+                                           const ZenFSReclaimOptions& options)
+    : zenfs_(zenfs), options_(options) {}
+
+ZenFSReclaimListener::~ZenFSReclaimListener() { Stop(); }
+
+void ZenFSReclaimListener::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(worker_mtx_);
+    stop_ = true;
+  }
+  worker_cv_.notify_one();
+  if (worker_) worker_->join();
+  worker_.reset();
+}
+
+void ZenFSReclaimListener::AddColumnFamily(ColumnFamilyHandle* handle) {
+  std::lock_guard<std::mutex> lock(cf_mtx_);
+  cf_handles_[handle->GetName()] = handle;
+}
+
+ColumnFamilyHandle* ZenFSReclaimListener::GetColumnFamily(
+    DB* db, const std::string& cf_name) {
+  std::lock_guard<std::mutex> lock(cf_mtx_);
+  auto it = cf_handles_.find(cf_name);
+  if (it != cf_handles_.end()) return it->second;
+
+  ColumnFamilyHandle* default_cf = db->DefaultColumnFamily();
+  if (default_cf->GetName() == cf_name) return default_cf;
+
+  return nullptr;
+}
+
+void ZenFSReclaimListener::OnFlushCompleted(DB* db,
+                                            const FlushJobInfo& /*info*/) {
+  MaybeReclaim(db);
+}
+
+void ZenFSReclaimListener::OnCompactionCompleted(
+    DB* db, const CompactionJobInfo& /*info*/) {
+  MaybeReclaim(db);
+}
+
+void ZenFSReclaimListener::MaybeReclaim(DB* db) {
+  {
+    std::lock_guard<std::mutex> lock(worker_mtx_);
+    if (stop_ || pending_db_ != nullptr) return;
+
+    /* The compactions we issue complete through this listener as well, and
+     * are kept from starting another round by the interval */
+    uint64_t now = Env::Default()->NowMicros();
+    if (now - last_round_us_ < options_.min_interval_us) return;
+    last_round_us_ = now;
+
+    pending_db_ = db;
+    if (!worker_) {
+      worker_.reset(
+          new std::thread(&ZenFSReclaimListener::ReclaimWorker, this));
+    }
+  }
+  worker_cv_.notify_one();
+}
+
+void ZenFSReclaimListener::ReclaimWorker() {
+  std::unique_lock<std::mutex> lock(worker_mtx_);
+
+  while (true) {
+    worker_cv_.wait(lock, [this] { return stop_ || pending_db_ != nullptr; });
+    if (stop_) return;
+
+    DB* db = pending_db_;
+    lock.unlock();
+    Reclaim(db);
+    lock.lock();
+    pending_db_ = nullptr;
+  }
+}
+
+void ZenFSReclaimListener::Reclaim(DB* db) {
+  if (options_.defragment_min_extents > 0)
+    zenfs_->DefragmentFiles(options_.defragment_min_extents);
+
+  std::vector<ZoneReclaimCandidate> candidates;
+  zenfs_->GetReclaimCandidates(candidates, options_.min_garbage_pct);
+  if (candidates.empty()) return;
+
+  std::vector<LiveFileMetaData> live_files;
+  db->GetLiveFilesMetaData(&live_files);
+
+  std::map<std::string, const LiveFileMetaData*> live_by_name;
+  for (const auto& file : live_files)
+    live_by_name[FileBasename(file.name)] = &file;
+
+  /* Group the best candidates by column family and level, as a manual
+   * compaction works on the files of a single column family */
+  std::map<std::pair<std::string, int>, std::vector<std::string>> jobs;
+  uint32_t picked = 0;
+  for (const auto& candidate : candidates) {
+    if (picked >= options_.max_files_per_round) break;
+
+    auto it = live_by_name.find(FileBasename(candidate.filename));
+    if (it == live_by_name.end() || it->second->being_compacted) continue;
+
+    const LiveFileMetaData* file = it->second;
+    jobs[std::make_pair(file->column_family_name, file->level)].push_back(
+        file->name);
+    picked++;
+  }
+
+  for (const auto& job : jobs) {
+    ColumnFamilyHandle* cf = GetColumnFamily(db, job.first.first);
+    if (cf == nullptr) continue;
+
+    /* Compact L0 files into L1, other levels into themselves */
+    int output_level = job.first.second == 0 ? 1 : job.first.second;
+    Status s =
+        db->CompactFiles(CompactionOptions(), cf, job.second, output_level);
+    if (s.ok()) compacted_files_ += job.second.size();
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,96 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "fs_zenfs.h"
+#include "rocksdb/db.h"
+#include "rocksdb/listener.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct ZenFSReclaimOptions {
+  // Maximum number of SST files handed to manual compactions per round
+  uint32_t max_files_per_round = 4;
+  // Zones with less garbage than this do not contribute to the pinned
+  // garbage score
+  uint32_t min_garbage_pct = 50;
+  // Minimum time between two reclaim rounds
+  uint64_t min_interval_us = 10 * 1000 * 1000;
+  // Closed files with at least this many extents, like WALs and MANIFESTs
+  // synced in small pieces, are defragmented every round. 0 to disable.
+  uint32_t defragment_min_extents = 64;
+};
+
+/* Compaction driven reclamation
+ *
+ * Instead of migrating the live data out of mostly-garbage zones, ask RocksDB
+ * to compact away the SST files pinning that data. The listener piggybacks on
+ * flush and compaction completions, ranks files through
+ * ZenFS::GetReclaimCandidates and runs a manual compaction on the best ones.
+ * Every round also defragments closed files with many small extents, see
+ * ZenFS::DefragmentFiles.
+ *
+ * Reclaim rounds run on a thread of the listener, so the flush and
+ * compaction threads of RocksDB are not held up. Call Stop() before closing
+ * the DB, to wait for the round in progress.
+ *
+ * Files of non-default column families are only compacted if the column
+ * family handle has been registered with AddColumnFamily().
+ */
+class ZenFSReclaimListener : public EventListener {
+ public:
+  explicit ZenFSReclaimListener(
+      ZenFS* zenfs, const ZenFSReclaimOptions& options = ZenFSReclaimOptions());
+  ~ZenFSReclaimListener();
+
+  const char* Name() const override { return "ZenFSReclaimListener"; }
+
+  void AddColumnFamily(ColumnFamilyHandle* handle);
+
+  void OnFlushCompleted(DB* db, const FlushJobInfo& info) override;
+  void OnCompactionCompleted(DB* db, const CompactionJobInfo& info) override;
+
+  uint64_t GetCompactedFiles() { return compacted_files_.load(); }
+
+  /* Wait for the reclaim round in progress and stop reclaiming */
+  void Stop();
+
+ private:
+  void MaybeReclaim(DB* db);
+  void ReclaimWorker();
+  void Reclaim(DB* db);
+  ColumnFamilyHandle* GetColumnFamily(DB* db, const std::string& cf_name);
+
+  ZenFS* zenfs_;
+  ZenFSReclaimOptions options_;
+
+  /* A round is requested by setting the DB to reclaim in */
+  std::mutex worker_mtx_;
+  std::condition_variable worker_cv_;
+  DB* pending_db_ = nullptr;
+  bool stop_ = false;
+  uint64_t last_round_us_ = 0;
+  std::unique_ptr<std::thread> worker_;
+  std::atomic<uint64_t> compacted_files_{0};
+
+  std::mutex cf_mtx_;
+  std::map<std::string, ColumnFamilyHandle*> cf_handles_;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
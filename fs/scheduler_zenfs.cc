@@ -0,0 +1,183 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "scheduler_zenfs.h"
+
+#include <assert.h>
+
+namespace ROCKSDB_NAMESPACE {
+
+ZoneIOClass GetZoneIOClass(IOType io_type, Env::WriteLifeTimeHint write_hint) {
+  if (io_type == IOType::kWAL) return ZoneIOClass::kWAL;
+
+  switch (write_hint) {
+    case Env::WLTH_LONG:
+      return ZoneIOClass::kShallowCompaction;
+    case Env::WLTH_EXTREME:
+      return ZoneIOClass::kDeepCompaction;
+    default:
+      /* Flushes and small, latency critical files like the MANIFEST */
+      return ZoneIOClass::kFlush;
+  }
+}
+
+ZoneTokenDeadline GetZoneTokenDeadline(std::chrono::microseconds timeout) {
+  if (timeout.count() <= 0) return ZONE_TOKEN_NO_DEADLINE;
+  return std::chrono::steady_clock::now() + timeout;
+}
+
+ZoneTokenScheduler::ZoneTokenScheduler() {
+  /* Keep a zone for WAL writes and one for flushes, so that they do not
+   * queue up behind compactions */
+  classes_[(uint32_t)ZoneIOClass::kWAL].min_tokens = 1;
+  classes_[(uint32_t)ZoneIOClass::kWAL].weight = 8;
+  classes_[(uint32_t)ZoneIOClass::kFlush].min_tokens = 1;
+  classes_[(uint32_t)ZoneIOClass::kFlush].weight = 4;
+  classes_[(uint32_t)ZoneIOClass::kShallowCompaction].weight = 2;
+}
+
+void ZoneTokenScheduler::SetMaxTokens(uint32_t max_tokens) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  max_tokens_ = max_tokens;
+  UpdateReservedLocked();
+  NotifyLocked();
+}
+
+void ZoneTokenScheduler::SetClassOptions(ZoneIOClass io_class,
+                                         uint32_t min_tokens,
+                                         uint32_t weight) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  classes_[(uint32_t)io_class].min_tokens = min_tokens;
+  classes_[(uint32_t)io_class].weight = weight;
+  UpdateReservedLocked();
+  NotifyLocked();
+}
+
+/* Always leave one token unreserved so that no class is starved, reserving
+ * for the highest priority classes first */
+void ZoneTokenScheduler::UpdateReservedLocked() {
+  uint32_t budget = max_tokens_ > 0 ? max_tokens_ - 1 : 0;
+
+  for (uint32_t c = 0; c < ZONE_IO_CLASS_NR; c++) {
+    uint32_t reserved = classes_[c].min_tokens;
+    if (reserved > budget) reserved = budget;
+    classes_[c].reserved = reserved;
+    budget -= reserved;
+  }
+}
+
+bool ZoneTokenScheduler::CanGrantLocked(uint32_t c, bool borrow) {
+  ClassState &cls = classes_[c];
+  uint32_t reserved_for_others = 0;
+
+  if (in_use_ >= max_tokens_) return false;
+  if (borrow || cls.in_use < cls.reserved) return true;
+
+  for (uint32_t i = 0; i < ZONE_IO_CLASS_NR; i++) {
+    if (i != c && classes_[i].in_use < classes_[i].reserved)
+      reserved_for_others += classes_[i].reserved - classes_[i].in_use;
+  }
+  if (max_tokens_ - in_use_ <= reserved_for_others) return false;
+
+  /* Let waiting classes with a smaller weighted share go first */
+  for (uint32_t i = 0; i < ZONE_IO_CLASS_NR; i++) {
+    if (i == c || classes_[i].waiting == 0) continue;
+    if ((uint64_t)classes_[i].in_use * cls.weight <
+        (uint64_t)cls.in_use * classes_[i].weight)
+      return false;
+  }
+
+  return true;
+}
+
+void ZoneTokenScheduler::NotifyLocked() {
+  for (uint32_t c = 0; c < ZONE_IO_CLASS_NR; c++) {
+    if (classes_[c].waiting > 0 && CanGrantLocked(c, false)) {
+      classes_[c].cv.notify_one();
+      return;
+    }
+  }
+}
+
+bool ZoneTokenScheduler::Get(ZoneIOClass io_class,
+                             const ZoneTokenDeadline &deadline) {
+  uint32_t c = (uint32_t)io_class;
+  std::unique_lock<std::mutex> lock(mtx_);
+
+  if (!CanGrantLocked(c, false)) {
+    auto can_grant = [this, c] { return CanGrantLocked(c, false); };
+    bool granted = true;
+
+    classes_[c].waiting++;
+    if (deadline == ZONE_TOKEN_NO_DEADLINE)
+      classes_[c].cv.wait(lock, can_grant);
+    else
+      granted = classes_[c].cv.wait_until(lock, deadline, can_grant);
+    classes_[c].waiting--;
+
+    if (!granted) {
+      /* We may have held back other classes by waiting */
+      NotifyLocked();
+      return false;
+    }
+  }
+
+  classes_[c].in_use++;
+  in_use_++;
+
+  /* There may be more tokens left for other waiters */
+  NotifyLocked();
+  return true;
+}
+
+bool ZoneTokenScheduler::TryGet(ZoneIOClass io_class, bool borrow) {
+  uint32_t c = (uint32_t)io_class;
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  if (!CanGrantLocked(c, borrow)) return false;
+
+  classes_[c].in_use++;
+  in_use_++;
+  return true;
+}
+
+void ZoneTokenScheduler::Take(ZoneIOClass io_class) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  classes_[(uint32_t)io_class].in_use++;
+  in_use_++;
+}
+
+void ZoneTokenScheduler::Put(ZoneIOClass io_class) {
+  uint32_t c = (uint32_t)io_class;
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  assert(classes_[c].in_use > 0 && in_use_ > 0);
+  classes_[c].in_use--;
+  in_use_--;
+  NotifyLocked();
+}
+
+void ZoneTokenScheduler::Move(ZoneIOClass from, ZoneIOClass to) {
+  if (from == to) return;
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  assert(classes_[(uint32_t)from].in_use > 0);
+  classes_[(uint32_t)from].in_use--;
+  classes_[(uint32_t)to].in_use++;
+  /* The class charged before may be below its minimum now */
+  NotifyLocked();
+}
+
+uint32_t ZoneTokenScheduler::GetInUse(ZoneIOClass io_class) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return classes_[(uint32_t)io_class].in_use;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,105 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Classes of zone allocations, from highest to lowest priority */
+enum class ZoneIOClass : uint32_t {
+  kWAL = 0,
+  kFlush,
+  kShallowCompaction, /* L0 to L1/L2 */
+  kDeepCompaction,
+  kGC,
+};
+
+#define ZONE_IO_CLASS_NR (5)
+
+using ZoneTokenDeadline = std::chrono::steady_clock::time_point;
+#define ZONE_TOKEN_NO_DEADLINE (ZoneTokenDeadline::max())
+
+/* Deadline for an IO with the given IOOptions timeout, 0 meaning none */
+ZoneTokenDeadline GetZoneTokenDeadline(std::chrono::microseconds timeout);
+
+/* Map an allocation to its class. RocksDB hints flushes with WLTH_MEDIUM,
+ * compactions into the first levels below L0 with WLTH_LONG and deeper
+ * compactions with WLTH_EXTREME. */
+ZoneIOClass GetZoneIOClass(IOType io_type, Env::WriteLifeTimeHint write_hint);
+
+struct ZoneIOClassOptions {
+  /* Open and active zones guaranteed to the class */
+  uint32_t min_open_zones = 0;
+  uint32_t min_active_zones = 0;
+  /* Share of the zones beyond the guaranteed minimums while other classes
+   * are waiting */
+  uint32_t weight = 1;
+};
+
+/* Hands out a limited number of zone tokens to allocators of different
+ * classes.
+ *
+ * Each class is guaranteed its minimum number of tokens. The remaining tokens
+ * go to the waiting class with the smallest number of tokens in use relative
+ * to its weight, higher priority classes first on ties. Every class waits on
+ * a condition variable of its own, so only a class that can take a returned
+ * token is woken up.
+ */
+class ZoneTokenScheduler {
+ public:
+  ZoneTokenScheduler();
+
+  void SetMaxTokens(uint32_t max_tokens);
+  void SetClassOptions(ZoneIOClass io_class, uint32_t min_tokens,
+                       uint32_t weight);
+
+  /* Wait for a token, returns false if the deadline passed first */
+  bool Get(ZoneIOClass io_class,
+           const ZoneTokenDeadline &deadline = ZONE_TOKEN_NO_DEADLINE);
+  /* Take a token if one is available to the class. A borrowing class may
+   * take tokens guaranteed to other classes. */
+  bool TryGet(ZoneIOClass io_class, bool borrow = false);
+  /* Take a token even if there is none left, for resources found in use */
+  void Take(ZoneIOClass io_class);
+  void Put(ZoneIOClass io_class);
+  /* Charge a token held by one class to another */
+  void Move(ZoneIOClass from, ZoneIOClass to);
+
+  uint32_t GetInUse(ZoneIOClass io_class);
+
+ private:
+  struct ClassState {
+    uint32_t min_tokens = 0;
+    uint32_t reserved = 0; /* min_tokens capped by the number of tokens */
+    uint32_t weight = 1;
+    uint32_t in_use = 0;
+    uint32_t waiting = 0;
+    std::condition_variable cv;
+  };
+
+  bool CanGrantLocked(uint32_t c, bool borrow);
+  void UpdateReservedLocked();
+  void NotifyLocked();
+
+  std::mutex mtx_;
+  uint32_t max_tokens_ = 0;
+  uint32_t in_use_ = 0;
+  ClassState classes_[ZONE_IO_CLASS_NR];
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
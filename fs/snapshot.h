@@ -68,10 +68,11 @@ class ZoneExtentSnapshot {
   std::string filename;
 
  public:
-  ZoneExtentSnapshot(const ZoneExtent& extent, const std::string fname)
+  ZoneExtentSnapshot(const ZoneExtent& extent, const Zone& zone,
+                     const std::string fname)
       : start(extent.start_),
         length(extent.length_),
-        zone_start(extent.zone_->start_),
+        zone_start(zone.start_),
         filename(fname) {}
 };
 
@@ -84,8 +85,9 @@ class ZoneFileSnapshot {
  public:
   ZoneFileSnapshot(ZoneFile& file)
       : file_id(file.GetID()), filename(file.GetFilename()) {
-    for (const auto* extent : file.GetExtents()) {
-      extents.emplace_back(*extent, filename);
+    for (const auto& extent : file.GetExtents()) {
+      extents.emplace_back(extent, *file.GetZbd()->GetIOZone(extent.start_),
+                           filename);
     }
   }
 };
@@ -109,4 +111,21 @@ class ZenFSSnapshot {
   std::vector<ZoneExtentSnapshot> extents_;
 };
 
+// A file whose deletion (e.g. by compacting it away) frees zone space.
+class ZoneReclaimCandidate {
+ public:
+  std::string filename;
+  uint64_t file_size;
+  // Written zone space that can be reset once the file is gone, i.e. the
+  // zones in which this file holds the last valid data.
+  uint64_t reclaimable;
+  // Garbage in the zones touched by the file, weighted by the file's share
+  // of the valid data in each zone.
+  uint64_t pinned_garbage;
+
+ public:
+  ZoneReclaimCandidate(const std::string& fname, uint64_t size)
+      : filename(fname), file_size(size), reclaimable(0), pinned_garbage(0) {}
+};
+
 }  // namespace ROCKSDB_NAMESPACE
@@ -11,13 +11,14 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <libzbd/zbd.h>
-#include <linux/blkzoned.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -30,6 +31,7 @@
 #include "rocksdb/env.h"
 #include "rocksdb/io_status.h"
 #include "snapshot.h"
+#include "util/coding.h"
 
 #define KB (1024)
 #define MB (1024 * KB)
@@ -44,19 +46,41 @@
 /* Minimum of number of zones that makes sense */
 #define ZENFS_MIN_ZONES (32)
 
+/* Zone tails smaller than this are not worth keeping active for small
+ * files */
+#define ZENFS_MIN_TAIL (1 * MB)
+
+/* Threads closing the zones left open by the last mount */
+#define ZENFS_MOUNT_CLOSE_WORKERS (8)
+
+/* Unused zones left by the last mount are reset in the background in
+ * batches of this many zones, so allocations waiting for an empty zone do
+ * not wait for all of them */
+#define ZENFS_MOUNT_RESET_BATCH (16)
+
+/* Threads writing full buffers of buffered files */
+#define ZENFS_WRITE_BEHIND_WORKERS (4)
+
 namespace ROCKSDB_NAMESPACE {
 
-Zone::Zone(ZonedBlockDevice *zbd, struct zbd_zone *z)
+Zone::Zone(ZonedBlockDevice *zbd, const ZoneInfo &z)
     : zbd_(zbd),
+      start_(z.start),
+      max_capacity_(z.capacity),
       busy_(false),
-      start_(zbd_zone_start(z)),
-      max_capacity_(zbd_zone_capacity(z)),
-      wp_(zbd_zone_wp(z)) {
+      wp_(z.wp) {
   lifetime_ = Env::WLTH_NOT_SET;
   used_capacity_ = 0;
   capacity_ = 0;
-  if (!(zbd_zone_full(z) || zbd_zone_offline(z) || zbd_zone_rdonly(z)))
-    capacity_ = zbd_zone_capacity(z) - (zbd_zone_wp(z) - zbd_zone_start(z));
+  first_write_time_ = 0;
+  placement_group_ = 0;
+  meta_dirty_ = false;
+  open_class_ = ZoneIOClass::kGC;
+  active_class_ = ZoneIOClass::kGC;
+  write_rate_ = 0;
+  write_rate_time_us_ = 0;
+  if (!(z.full || z.offline || z.readonly))
+    capacity_ = z.capacity - (z.wp - z.start);
 }
 
 bool Zone::IsUsed() { return (used_capacity_ > 0); }
@@ -72,47 +96,52 @@ void Zone::EncodeJson(std::ostream &json_stream) {
   json_stream << "\"max_capacity\":" << max_capacity_ << ",";
   json_stream << "\"wp\":" << wp_ << ",";
   json_stream << "\"lifetime\":" << lifetime_ << ",";
+  json_stream << "\"first_write_time\":" << first_write_time_ << ",";
+  json_stream << "\"placement_group\":" << placement_group_.load() << ",";
   json_stream << "\"used_capacity\":" << used_capacity_;
   json_stream << "}";
 }
 
 IOStatus Zone::Reset() {
-  size_t zone_sz = zbd_->GetZoneSize();
-  unsigned int report = 1;
-  struct zbd_zone z;
-  int ret;
-
   assert(!IsUsed());
   assert(IsBusy());
 
-  ret = zbd_reset_zones(zbd_->GetWriteFD(), start_, zone_sz);
-  if (ret) return IOStatus::IOError("Zone reset failed\n");
+  IOStatus s = zbd_->GetBackend()->Reset(start_, 1);
+  if (!s.ok()) {
+    RefreshState();
+    return s;
+  }
 
-  ret = zbd_report_zones(zbd_->GetReadFD(), start_, zone_sz, ZBD_RO_ALL, &z,
-                         &report);
+  ResetState();
+  return IOStatus::OK();
+}
 
-  if (ret || (report != 1)) return IOStatus::IOError("Zone report failed\n");
+void Zone::RefreshState() {
+  std::vector<ZoneInfo> z;
 
-  if (zbd_zone_offline(&z))
-    capacity_ = 0;
-  else
-    max_capacity_ = capacity_ = zbd_zone_capacity(&z);
+  if (!zbd_->GetBackend()->ReportZones(start_, 1, &z).ok()) return;
+  if (z[0].offline || z[0].readonly) capacity_ = 0;
+}
 
+void Zone::ResetState() {
+  /* The capacity of a zone does not change on reset, use the capacity
+   * reported when the device was opened */
+  capacity_ = max_capacity_;
   wp_ = start_;
   lifetime_ = Env::WLTH_NOT_SET;
-
-  return IOStatus::OK();
+  first_write_time_ = 0;
+  write_rate_ = 0;
+  placement_group_ = 0;
+  meta_dirty_ = false;
 }
 
 IOStatus Zone::Finish() {
   size_t zone_sz = zbd_->GetZoneSize();
-  int fd = zbd_->GetWriteFD();
-  int ret;
 
   assert(IsBusy());
 
-  ret = zbd_finish_zones(fd, start_, zone_sz);
-  if (ret) return IOStatus::IOError("Zone finish failed\n");
+  IOStatus s = zbd_->GetBackend()->Finish(start_);
+  if (!s.ok()) return s;
 
   capacity_ = 0;
   wp_ = start_ + zone_sz;
@@ -121,27 +150,40 @@ IOStatus Zone::Finish() {
 }
 
 IOStatus Zone::Close() {
-  size_t zone_sz = zbd_->GetZoneSize();
-  int fd = zbd_->GetWriteFD();
-  int ret;
-
   assert(IsBusy());
 
   if (!(IsEmpty() || IsFull())) {
-    ret = zbd_close_zones(fd, start_, zone_sz);
-    if (ret) return IOStatus::IOError("Zone close failed\n");
+    IOStatus s = zbd_->GetBackend()->Close(start_);
+    if (!s.ok()) return s;
   }
 
   return IOStatus::OK();
 }
 
+#define ZONE_WRITE_RATE_WINDOW_S (10)
+
+static uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static double DecayWriteRate(double rate, uint64_t from_us, uint64_t to_us) {
+  if (to_us <= from_us) return rate;
+  double elapsed_s = (to_us - from_us) / 1000000.0;
+  return rate * std::exp(-elapsed_s / ZONE_WRITE_RATE_WINDOW_S);
+}
+
+double Zone::GetWriteRate() {
+  return DecayWriteRate(write_rate_, write_rate_time_us_, NowMicros());
+}
+
 IOStatus Zone::Append(char *data, uint32_t size) {
   ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_ZONE_WRITE_LATENCY,
                                  Env::Default());
   zbd_->GetMetrics()->ReportThroughput(ZENFS_ZONE_WRITE_THROUGHPUT, size);
   char *ptr = data;
   uint32_t left = size;
-  int fd = zbd_->GetWriteFD();
   int ret;
 
   if (capacity_ < size)
@@ -149,8 +191,13 @@ IOStatus Zone::Append(char *data, uint32_t size) {
 
   assert((size % zbd_->GetBlockSize()) == 0);
 
+  if (IsEmpty()) {
+    first_write_time_ = time(0);
+    zbd_->MarkZoneMetaDirty(this);
+  }
+
   while (left) {
-    ret = pwrite(fd, ptr, left, wp_);
+    ret = zbd_->GetBackend()->Write(ptr, left, wp_);
     if (ret < 0) {
       return IOStatus::IOError(strerror(errno));
     }
@@ -162,9 +209,28 @@ IOStatus Zone::Append(char *data, uint32_t size) {
     zbd_->AddBytesWritten(ret);
   }
 
+  uint64_t now = NowMicros();
+  write_rate_ = DecayWriteRate(write_rate_, write_rate_time_us_, now) +
+                (double)size / ZONE_WRITE_RATE_WINDOW_S;
+  write_rate_time_us_ = now;
+
   return IOStatus::OK();
 }
 
+IOStatus Zone::SequencedAppend(char *data, uint32_t size, uint32_t *written,
+                               uint64_t *offset) {
+  std::lock_guard<std::mutex> lock(append_mtx_);
+  uint32_t wr_size = size;
+
+  if (wr_size > capacity_) wr_size = capacity_;
+
+  *offset = wp_;
+  *written = wr_size;
+  if (wr_size == 0) return IOStatus::OK();
+
+  return Append(data, wr_size);
+}
+
 inline IOStatus Zone::CheckRelease() {
   if (!Release()) {
     assert(false);
@@ -176,143 +242,88 @@ inline IOStatus Zone::CheckRelease() {
 }
 
 Zone *ZonedBlockDevice::GetIOZone(uint64_t offset) {
-  for (const auto z : io_zones)
-    if (z->start_ <= offset && offset < (z->start_ + zone_sz_)) return z;
-  return nullptr;
+  if (io_zone_index_.empty()) return nullptr;
+  uint64_t zone_nr = offset / zone_sz_;
+  if (zone_nr >= io_zone_index_.size()) return nullptr;
+  return io_zone_index_[zone_nr];
 }
 
 ZonedBlockDevice::ZonedBlockDevice(std::string bdevname,
                                    std::shared_ptr<Logger> logger,
                                    std::shared_ptr<ZenFSMetrics> metrics)
-    : filename_("/dev/" + bdevname),
-      read_f_(-1),
-      read_direct_f_(-1),
-      write_f_(-1),
-      logger_(logger),
-      metrics_(metrics) {
-  Info(logger_, "New Zoned Block Device: %s", filename_.c_str());
-}
-
-std::string ZonedBlockDevice::ErrorToString(int err) {
-  char *err_str = strerror(err);
-  if (err_str != nullptr) return std::string(err_str);
-  return "";
-}
-
-IOStatus ZonedBlockDevice::CheckScheduler() {
-  std::ostringstream path;
-  std::string s = filename_;
-  std::fstream f;
-
-  s.erase(0, 5);  // Remove "/dev/" from /dev/nvmeXnY
-  path << "/sys/block/" << s << "/queue/scheduler";
-  f.open(path.str(), std::fstream::in);
-  if (!f.is_open()) {
-    return IOStatus::InvalidArgument("Failed to open " + path.str());
-  }
-
-  std::string buf;
-  getline(f, buf);
-  if (buf.find("[mq-deadline]") == std::string::npos) {
-    f.close();
-    return IOStatus::InvalidArgument(
-        "Current ZBD scheduler is not mq-deadline, set it to mq-deadline.");
-  }
-
-  f.close();
-  return IOStatus::OK();
+    : ZonedBlockDevice(NewZonedBlockDeviceBackend(bdevname), logger,
+                       metrics) {}
+
+ZonedBlockDevice::ZonedBlockDevice(
+    std::unique_ptr<ZonedBlockDeviceBackend> backend,
+    std::shared_ptr<Logger> logger, std::shared_ptr<ZenFSMetrics> metrics)
+    : zbd_be_(std::move(backend)), logger_(logger), metrics_(metrics) {
+  Info(logger_, "New Zoned Block Device: %s",
+       zbd_be_->GetFilename().c_str());
 }
 
 IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
-  struct zbd_zone *zone_rep;
+  std::vector<ZoneInfo> zone_rep;
   unsigned int reported_zones;
-  uint64_t addr_space_sz;
-  zbd_info info;
-  Status s;
   uint64_t i = 0;
   uint64_t m = 0;
   // Reserve one zone for metadata and another one for extent migration
   int reserved_zones = 2;
-  int ret;
 
   if (!readonly && !exclusive)
     return IOStatus::InvalidArgument("Write opens must be exclusive");
 
-  /* The non-direct file descriptor acts as an exclusive-use semaphore */
-  if (exclusive) {
-    read_f_ = zbd_open(filename_.c_str(), O_RDONLY | O_EXCL, &info);
-  } else {
-    read_f_ = zbd_open(filename_.c_str(), O_RDONLY, &info);
-  }
+  IOStatus ios = zbd_be_->Open(readonly, exclusive);
+  if (!ios.ok()) return ios;
 
-  if (read_f_ < 0) {
-    return IOStatus::InvalidArgument(
-        "Failed to open zoned block device for read: " + ErrorToString(errno));
-  }
-
-  read_direct_f_ = zbd_open(filename_.c_str(), O_RDONLY | O_DIRECT, &info);
-  if (read_direct_f_ < 0) {
-    return IOStatus::InvalidArgument(
-        "Failed to open zoned block device for direct read: " +
-        ErrorToString(errno));
-  }
-
-  if (readonly) {
-    write_f_ = -1;
-  } else {
-    write_f_ = zbd_open(filename_.c_str(), O_WRONLY | O_DIRECT, &info);
-    if (write_f_ < 0) {
-      return IOStatus::InvalidArgument(
-          "Failed to open zoned block device for write: " +
-          ErrorToString(errno));
-    }
-  }
-
-  if (info.model != ZBD_DM_HOST_MANAGED) {
-    return IOStatus::NotSupported("Not a host managed block device");
-  }
-
-  if (info.nr_zones < ZENFS_MIN_ZONES) {
+  if (zbd_be_->GetNrZones() < ZENFS_MIN_ZONES) {
     return IOStatus::NotSupported(
         "To few zones on zoned block device (32 required)");
   }
 
-  IOStatus ios = CheckScheduler();
-  if (ios != IOStatus::OK()) return ios;
+  block_sz_ = zbd_be_->GetBlockSize();
+  zone_sz_ = zbd_be_->GetZoneSize();
+  nr_zones_ = zbd_be_->GetNrZones();
 
-  block_sz_ = info.pblock_size;
-  zone_sz_ = info.zone_size;
-  nr_zones_ = info.nr_zones;
+  /* Extent lengths are kept in 32 bits */
+  if (zone_sz_ > UINT32_MAX) {
+    return IOStatus::NotSupported("Zones larger than 4 GB are not supported");
+  }
 
-  if (info.max_nr_active_zones == 0)
-    max_nr_active_io_zones_ = info.nr_zones;
+  if (zbd_be_->GetMaxActiveZones() == 0)
+    max_nr_active_io_zones_ = nr_zones_;
   else
-    max_nr_active_io_zones_ = info.max_nr_active_zones - reserved_zones;
+    max_nr_active_io_zones_ = zbd_be_->GetMaxActiveZones() - reserved_zones;
 
-  if (info.max_nr_open_zones == 0)
-    max_nr_open_io_zones_ = info.nr_zones;
+  if (zbd_be_->GetMaxOpenZones() == 0)
+    max_nr_open_io_zones_ = nr_zones_;
   else
-    max_nr_open_io_zones_ = info.max_nr_open_zones - reserved_zones;
+    max_nr_open_io_zones_ = zbd_be_->GetMaxOpenZones() - reserved_zones;
 
-  Info(logger_, "Zone block device nr zones: %u max active: %u max open: %u \n",
-       info.nr_zones, info.max_nr_active_zones, info.max_nr_open_zones);
+  open_zone_scheduler_.SetMaxTokens(max_nr_open_io_zones_);
+  active_zone_scheduler_.SetMaxTokens(max_nr_active_io_zones_);
 
-  addr_space_sz = (uint64_t)nr_zones_ * zone_sz_;
-
-  ret = zbd_list_zones(read_f_, 0, addr_space_sz, ZBD_RO_ALL, &zone_rep,
-                       &reported_zones);
+  Info(logger_, "Zone block device nr zones: %u max active: %u max open: %u \n",
+       nr_zones_, zbd_be_->GetMaxActiveZones(), zbd_be_->GetMaxOpenZones());
 
-  if (ret || reported_zones != nr_zones_) {
-    Error(logger_, "Failed to list zones, err: %d", ret);
-    return IOStatus::IOError("Failed to list zones");
+  ios = zbd_be_->ListZones(&zone_rep);
+  if (!ios.ok()) {
+    Error(logger_, "Failed to list zones: %s", ios.ToString().c_str());
+    return ios;
   }
+  reported_zones = zone_rep.size();
+
+  FreeZones();
+  zones_allocated_ = reported_zones;
+  zones_ = std::allocator<Zone>().allocate(zones_allocated_);
+  io_zone_index_.assign(reported_zones, nullptr);
 
   while (m < ZENFS_META_ZONES && i < reported_zones) {
-    struct zbd_zone *z = &zone_rep[i++];
+    const ZoneInfo &z = zone_rep[i++];
     /* Only use sequential write required zones */
-    if (zbd_zone_type(z) == ZBD_ZONE_TYPE_SWR) {
-      if (!zbd_zone_offline(z)) {
-        meta_zones.push_back(new Zone(this, z));
+    if (z.seq_write_required) {
+      if (!z.offline) {
+        meta_zones.push_back(NewZone(z));
       }
       m++;
     }
@@ -321,25 +332,29 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
   active_io_zones_ = 0;
   open_io_zones_ = 0;
 
+  std::vector<Zone *> to_close;
   for (; i < reported_zones; i++) {
-    struct zbd_zone *z = &zone_rep[i];
+    const ZoneInfo &z = zone_rep[i];
     /* Only use sequential write required zones */
-    if (zbd_zone_type(z) == ZBD_ZONE_TYPE_SWR) {
-      if (!zbd_zone_offline(z)) {
-        Zone *newZone = new Zone(this, z);
+    if (z.seq_write_required) {
+      if (!z.offline) {
+        Zone *newZone = NewZone(z);
         if (!newZone->Acquire()) {
           assert(false);
           return IOStatus::Corruption("Failed to set busy flag of zone " +
                                       std::to_string(newZone->GetZoneNr()));
         }
         io_zones.push_back(newZone);
-        if (zbd_zone_imp_open(z) || zbd_zone_exp_open(z) ||
-            zbd_zone_closed(z)) {
+        io_zone_index_[newZone->GetZoneNr()] = newZone;
+        if (z.open || z.closed) {
+          /* Zones left active by the last mount are charged to the lowest
+           * priority class until they are finished or reset */
+          active_zone_scheduler_.Take(ZoneIOClass::kGC);
           active_io_zones_++;
-          if (zbd_zone_imp_open(z) || zbd_zone_exp_open(z)) {
-            if (!readonly) {
-              newZone->Close();
-            }
+          /* Closed after the scan, still holding the busy flag */
+          if (z.open && !readonly) {
+            to_close.push_back(newZone);
+            continue;
           }
         }
         IOStatus status = newZone->CheckRelease();
@@ -348,12 +363,60 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
     }
   }
 
-  free(zone_rep);
+  ios = CloseZones(to_close);
+  if (!ios.ok()) return ios;
+
   start_time_ = time(NULL);
 
   return IOStatus::OK();
 }
 
+Zone *ZonedBlockDevice::NewZone(const ZoneInfo &z) {
+  assert(zones_constructed_ < zones_allocated_);
+  return new (&zones_[zones_constructed_++]) Zone(this, z);
+}
+
+void ZonedBlockDevice::FreeZones() {
+  for (uint32_t i = 0; i < zones_constructed_; i++) zones_[i].~Zone();
+  if (zones_ != nullptr)
+    std::allocator<Zone>().deallocate(zones_, zones_allocated_);
+  zones_ = nullptr;
+  zones_constructed_ = 0;
+  zones_allocated_ = 0;
+  meta_zones.clear();
+  io_zones.clear();
+  io_zone_index_.clear();
+}
+
+IOStatus ZonedBlockDevice::CloseZones(const std::vector<Zone *> &zones) {
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> workers;
+
+  /* Closing is a zone management command per zone, which the device can
+   * process in parallel */
+  auto close_zones = [&]() {
+    size_t j;
+    while ((j = next++) < zones.size()) {
+      IOStatus s = zones[j]->Close();
+      if (!s.ok())
+        Warn(logger_, "Failed to close zone %lu: %s", zones[j]->GetZoneNr(),
+             s.ToString().c_str());
+    }
+  };
+
+  size_t nr_workers = std::min<size_t>(zones.size(), ZENFS_MOUNT_CLOSE_WORKERS);
+  for (size_t w = 1; w < nr_workers; w++) workers.emplace_back(close_zones);
+  close_zones();
+  for (auto &worker : workers) worker.join();
+
+  IOStatus s;
+  for (const auto z : zones) {
+    IOStatus release_status = z->CheckRelease();
+    if (s.ok()) s = release_status;
+  }
+  return s;
+}
+
 uint64_t ZonedBlockDevice::GetFreeSpace() {
   uint64_t free = 0;
   for (const auto z : io_zones) {
@@ -362,6 +425,15 @@ uint64_t ZonedBlockDevice::GetFreeSpace() {
   return free;
 }
 
+uint64_t ZonedBlockDevice::GetUsableZoneCapacity() {
+  uint64_t usable = zone_sz_;
+  for (const auto z : io_zones) {
+    if (z->max_capacity_ > 0 && z->max_capacity_ < usable)
+      usable = z->max_capacity_;
+  }
+  return usable;
+}
+
 uint64_t ZonedBlockDevice::GetUsedSpace() {
   uint64_t used = 0;
   for (const auto z : io_zones) {
@@ -457,39 +529,14 @@ void ZonedBlockDevice::LogGarbageInfo() {
 }
 
 ZonedBlockDevice::~ZonedBlockDevice() {
-  for (const auto z : meta_zones) {
-    delete z;
-  }
-
-  for (const auto z : io_zones) {
-    delete z;
-  }
-
-  zbd_close(read_f_);
-  zbd_close(read_direct_f_);
-  zbd_close(write_f_);
+  StopBackgroundWork();
+  StopWriteBehind();
+  FreeZones();
 }
 
-#define LIFETIME_DIFF_NOT_GOOD (100)
-#define LIFETIME_DIFF_COULD_BE_WORSE (50)
-
-unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
-                             Env::WriteLifeTimeHint file_lifetime) {
-  assert(file_lifetime <= Env::WLTH_EXTREME);
-
-  if ((file_lifetime == Env::WLTH_NOT_SET) ||
-      (file_lifetime == Env::WLTH_NONE)) {
-    if (file_lifetime == zone_lifetime) {
-      return 0;
-    } else {
-      return LIFETIME_DIFF_NOT_GOOD;
-    }
-  }
-
-  if (zone_lifetime > file_lifetime) return zone_lifetime - file_lifetime;
-  if (zone_lifetime == file_lifetime) return LIFETIME_DIFF_COULD_BE_WORSE;
-
-  return LIFETIME_DIFF_NOT_GOOD;
+void ZonedBlockDevice::StopBackgroundWork() {
+  StopMountReset();
+  StopZonePools();
 }
 
 IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
@@ -520,76 +567,363 @@ IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
 }
 
 IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
-  for (const auto z : io_zones) {
+  return ResetUnusedIOZones(io_zones);
+}
+
+IOStatus ZonedBlockDevice::ResetUnusedIOZones(
+    const std::vector<Zone *> &zones) {
+  std::vector<Zone *> resets;
+  IOStatus s;
+
+  for (const auto z : zones) {
     if (z->Acquire()) {
       if (!z->IsEmpty() && !z->IsUsed()) {
-        bool full = z->IsFull();
-        IOStatus reset_status = z->Reset();
-        IOStatus release_status = z->CheckRelease();
-        if (!reset_status.ok()) return reset_status;
-        if (!release_status.ok()) return release_status;
-        if (!full) PutActiveIOZoneToken();
+        resets.push_back(z);
       } else {
         IOStatus release_status = z->CheckRelease();
-        if (!release_status.ok()) return release_status;
+        if (!release_status.ok()) {
+          s = release_status;
+          break;
+        }
       }
     }
   }
-  return IOStatus::OK();
+
+  /* The zones collected are acquired, reset and release them even if
+   * another zone failed */
+  IOStatus reset_status = ResetZones(resets);
+  return s.ok() ? reset_status : s;
 }
 
-void ZonedBlockDevice::WaitForOpenIOZoneToken(bool prioritized) {
-  long allocator_open_limit;
+IOStatus ZonedBlockDevice::ResetZones(std::vector<Zone *> &zones) {
+  IOStatus s;
 
-  /* Avoid non-priortized allocators from starving prioritized ones */
-  if (prioritized) {
-    allocator_open_limit = max_nr_open_io_zones_;
-  } else {
-    allocator_open_limit = max_nr_open_io_zones_ - 1;
+  std::sort(zones.begin(), zones.end(),
+            [](Zone *a, Zone *b) { return a->start_ < b->start_; });
+
+  size_t i = 0;
+  while (i < zones.size()) {
+    size_t n = 1;
+    while (i + n < zones.size() &&
+           zones[i + n]->start_ == zones[i + n - 1]->start_ + zone_sz_)
+      n++;
+
+    IOStatus range_status = zbd_be_->Reset(zones[i]->start_, n);
+    for (size_t j = i; j < i + n; j++) {
+      Zone *z = zones[j];
+      bool full = z->IsFull();
+      IOStatus reset_status;
+
+      /* Retry the zones one by one, so a single bad zone does not keep the
+       * rest of the range from being reset */
+      if (range_status.ok())
+        z->ResetState();
+      else
+        reset_status = z->Reset();
+
+      if (reset_status.ok() && !full) PutActiveIOZoneToken(z->active_class_);
+      if (s.ok()) s = reset_status;
+
+      IOStatus release_status = z->CheckRelease();
+      if (s.ok()) s = release_status;
+    }
+    i += n;
+    NotifyZonesReset();
+  }
+
+  return s;
+}
+
+void ZonedBlockDevice::NotifyZonesReset() {
+  {
+    std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+    zones_reset_++;
+  }
+  mount_reset_cv_.notify_all();
+}
+
+void ZonedBlockDevice::StartMountReset() {
+  std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+  if (mount_reset_worker_) return;
+  mount_reset_running_ = true;
+  mount_reset_worker_.reset(
+      new std::thread(&ZonedBlockDevice::MountResetWorker, this));
+}
+
+void ZonedBlockDevice::StopMountReset() {
+  {
+    std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+    mount_reset_stop_ = true;
   }
+  mount_reset_cv_.notify_all();
+  if (mount_reset_worker_) mount_reset_worker_->join();
+  mount_reset_worker_.reset();
+}
+
+void ZonedBlockDevice::MountResetWorker() {
+  IOStatus s;
+  uint64_t start_time = time(NULL);
+
+  for (size_t i = 0; i < io_zones.size(); i += ZENFS_MOUNT_RESET_BATCH) {
+    {
+      std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+      if (mount_reset_stop_) break;
+    }
+    size_t end = std::min<size_t>(i + ZENFS_MOUNT_RESET_BATCH, io_zones.size());
+    std::vector<Zone *> batch(io_zones.begin() + i, io_zones.begin() + end);
+    s = ResetUnusedIOZones(batch);
+    if (!s.ok()) {
+      Error(logger_, "Failed to reset unused IO zones: %s",
+            s.ToString().c_str());
+      SetZoneDeferredStatus(s);
+      break;
+    }
+  }
+
+  if (s.ok())
+    Info(logger_, "Reset unused IO zones in %lu s", time(NULL) - start_time);
+
+  {
+    std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+    mount_reset_running_ = false;
+  }
+  mount_reset_cv_.notify_all();
+}
+
+void ZonedBlockDevice::ScheduleWriteBehind(ZoneIOClass io_class,
+                                           std::function<void()> write) {
+  {
+    std::lock_guard<std::mutex> lock(write_behind_mtx_);
+    if (write_behind_workers_.empty()) {
+      for (int i = 0; i < ZENFS_WRITE_BEHIND_WORKERS; i++)
+        write_behind_workers_.emplace_back(&ZonedBlockDevice::WriteBehindWorker,
+                                           this);
+    }
+    write_behind_queues_[(uint32_t)io_class].push_back(std::move(write));
+  }
+  write_behind_cv_.notify_one();
+}
+
+void ZonedBlockDevice::WriteBehindWorker() {
+  std::unique_lock<std::mutex> lock(write_behind_mtx_);
+
+  while (true) {
+    std::deque<std::function<void()>> *queue = nullptr;
+    write_behind_cv_.wait(lock, [this, &queue] {
+      for (auto &q : write_behind_queues_) {
+        if (!q.empty()) {
+          queue = &q;
+          return true;
+        }
+      }
+      return write_behind_stop_;
+    });
+    if (queue == nullptr) return;
+
+    std::function<void()> write = std::move(queue->front());
+    queue->pop_front();
+    lock.unlock();
+    write();
+    lock.lock();
+  }
+}
+
+/* Writes queued by files still open are finished first */
+void ZonedBlockDevice::StopWriteBehind() {
+  {
+    std::lock_guard<std::mutex> lock(write_behind_mtx_);
+    write_behind_stop_ = true;
+  }
+  write_behind_cv_.notify_all();
+  for (auto &worker : write_behind_workers_) worker.join();
+  write_behind_workers_.clear();
+}
+
+/* Label of a per class zone token metric, the labels are laid out in class
+ * order */
+static ZenFSMetricsHistograms ClassLabel(ZenFSMetricsHistograms base,
+                                         ZoneIOClass io_class) {
+  return (ZenFSMetricsHistograms)((uint32_t)base + (uint32_t)io_class);
+}
+
+static IOStatus ZoneTokenTimedOut() {
+  IOStatus s = IOStatus::TimedOut("Timed out waiting for a zone");
+  s.SetRetryable(true);
+  return s;
+}
+
+IOStatus ZonedBlockDevice::WaitForOpenIOZoneToken(
+    ZoneIOClass io_class, const ZoneTokenDeadline &deadline) {
+  ZenFSMetricsLatencyGuard guard(
+      metrics_, ClassLabel(ZENFS_WAL_ZONE_TOKEN_WAIT_LATENCY, io_class),
+      Env::Default());
 
   /* Wait for an open IO Zone token - after this function returns
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutOpenIOZoneToken to return the resource
    */
-  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  zone_resources_.wait(lk, [this, allocator_open_limit] {
-    if (open_io_zones_.load() < allocator_open_limit) {
-      open_io_zones_++;
-      return true;
-    } else {
-      return false;
+  if (!open_zone_scheduler_.TryGet(io_class)) {
+    metrics_->ReportQPS(ClassLabel(ZENFS_WAL_ZONE_TOKEN_WAIT_QPS, io_class), 1);
+    if (!open_zone_scheduler_.Get(io_class, deadline)) {
+      metrics_->ReportQPS(
+          ClassLabel(ZENFS_WAL_ZONE_TOKEN_TIMEOUT_QPS, io_class), 1);
+      return ZoneTokenTimedOut();
     }
-  });
+  }
+  open_io_zones_++;
+  return IOStatus::OK();
 }
 
-bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable() {
+bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable(ZoneIOClass io_class,
+                                                       bool borrow) {
   /* Grap an active IO Zone token if available - after this function returns
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutActiveIOZoneToken to return the resource
    */
-  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  if (active_io_zones_.load() < max_nr_active_io_zones_) {
-    active_io_zones_++;
-    return true;
+  if (!active_zone_scheduler_.TryGet(io_class, borrow)) return false;
+  active_io_zones_++;
+  return true;
+}
+
+void ZonedBlockDevice::PutOpenIOZoneToken(ZoneIOClass io_class) {
+  open_io_zones_--;
+  open_zone_scheduler_.Put(io_class);
+}
+
+void ZonedBlockDevice::PutActiveIOZoneToken(ZoneIOClass io_class) {
+  active_io_zones_--;
+  active_zone_scheduler_.Put(io_class);
+}
+
+void ZonedBlockDevice::ChargeActiveIOZoneToken(Zone *zone,
+                                               ZoneIOClass io_class) {
+  if (zone->active_class_ == io_class) return;
+  active_zone_scheduler_.Move(zone->active_class_, io_class);
+  zone->active_class_ = io_class;
+}
+
+void ZonedBlockDevice::SetZoneIOClassOptions(
+    ZoneIOClass io_class, const ZoneIOClassOptions &options) {
+  open_zone_scheduler_.SetClassOptions(io_class, options.min_open_zones,
+                                       options.weight);
+  active_zone_scheduler_.SetClassOptions(io_class, options.min_active_zones,
+                                         options.weight);
+}
+
+void ZonedBlockDevice::StartZonePools() {
+  if (zone_pool_worker_) return;
+  zone_pool_worker_.reset(
+      new std::thread(&ZonedBlockDevice::ZonePoolWorker, this));
+}
+
+void ZonedBlockDevice::StopZonePools() {
+  {
+    std::lock_guard<std::mutex> lock(zone_pool_mtx_);
+    zone_pool_stop_ = true;
+  }
+  zone_pool_cv_.notify_one();
+  if (zone_pool_worker_) zone_pool_worker_->join();
+  zone_pool_worker_.reset();
+
+  while (ReleasePooledZone()) {
   }
-  return false;
 }
 
-void ZonedBlockDevice::PutOpenIOZoneToken() {
+void ZonedBlockDevice::SetZonePoolSize(ZoneIOClass io_class, uint32_t size) {
   {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    open_io_zones_--;
+    std::lock_guard<std::mutex> lock(zone_pool_mtx_);
+    zone_pool_size_[(uint32_t)io_class] = size;
+  }
+  zone_pool_cv_.notify_one();
+}
+
+void ZonedBlockDevice::ZonePoolWorker() {
+  std::unique_lock<std::mutex> lock(zone_pool_mtx_);
+
+  while (!zone_pool_stop_) {
+    bool refilled = false;
+
+    for (uint32_t c = 0; c < ZONE_IO_CLASS_NR && !zone_pool_stop_; c++) {
+      ZoneIOClass io_class = (ZoneIOClass)c;
+      if (zone_pools_[c].size() >= zone_pool_size_[c]) continue;
+
+      /* Only take active zone tokens that are free, finishing zones to make
+       * room for the pools would waste capacity */
+      lock.unlock();
+      Zone *zone = nullptr;
+      if (GetActiveIOZoneTokenIfAvailable(io_class)) {
+        IOStatus s = AllocateEmptyZone(&zone);
+        if (!s.ok() || zone == nullptr) {
+          PutActiveIOZoneToken(io_class);
+          zone = nullptr;
+        }
+      }
+      lock.lock();
+
+      if (zone != nullptr) {
+        zone->active_class_ = io_class;
+        zone_pools_[c].push_back(zone);
+        refilled = true;
+      }
+    }
+
+    /* Retry now and then, as active zone tokens are returned without
+     * notifying the pools */
+    if (!refilled)
+      zone_pool_cv_.wait_for(lock, std::chrono::milliseconds(100));
   }
-  zone_resources_.notify_one();
 }
 
-void ZonedBlockDevice::PutActiveIOZoneToken() {
+Zone *ZonedBlockDevice::TakePooledZone(ZoneIOClass io_class) {
+  Zone *zone = nullptr;
   {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    active_io_zones_--;
+    std::lock_guard<std::mutex> lock(zone_pool_mtx_);
+    std::vector<Zone *> &pool = zone_pools_[(uint32_t)io_class];
+    if (pool.empty()) return nullptr;
+    zone = pool.back();
+    pool.pop_back();
+  }
+  zone_pool_cv_.notify_one();
+  return zone;
+}
+
+/* Remove a pooled zone, lowest priority class first */
+Zone *ZonedBlockDevice::PopPooledZone(ZoneIOClass *io_class) {
+  std::lock_guard<std::mutex> lock(zone_pool_mtx_);
+  for (uint32_t c = ZONE_IO_CLASS_NR; c-- > 0;) {
+    if (!zone_pools_[c].empty()) {
+      Zone *zone = zone_pools_[c].back();
+      zone_pools_[c].pop_back();
+      *io_class = (ZoneIOClass)c;
+      return zone;
+    }
   }
-  zone_resources_.notify_one();
+  return nullptr;
+}
+
+/* Give back a pooled zone and its active zone token */
+bool ZonedBlockDevice::ReleasePooledZone() {
+  ZoneIOClass io_class;
+  Zone *zone = PopPooledZone(&io_class);
+  if (zone == nullptr) return false;
+
+  zone->Release();
+  PutActiveIOZoneToken(io_class);
+  return true;
+}
+
+/* Give back a pooled zone and hand its active zone token to io_class. The
+ * token is never put back, so the pool worker can't refill with it before
+ * the caller gets it. */
+bool ZonedBlockDevice::TakePooledZoneToken(ZoneIOClass io_class) {
+  ZoneIOClass pool_class;
+  Zone *zone = PopPooledZone(&pool_class);
+  if (zone == nullptr) return false;
+
+  zone->Release();
+  if (pool_class != io_class)
+    active_zone_scheduler_.Move(pool_class, io_class);
+  return true;
 }
 
 IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
@@ -601,7 +935,15 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
     if (z->Acquire()) {
       bool within_finish_threshold =
           z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
-      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold) {
+      /* Keep tails that can still take a small file while we are not short
+       * of active zones */
+      bool tail_usable = z->capacity_ >= ZENFS_MIN_TAIL &&
+                         active_io_zones_.load() < max_nr_active_io_zones_;
+      /* Zones that are still being written to will fill up by themselves */
+      bool filling = z->GetWriteRate() * ZONE_WRITE_RATE_WINDOW_S >=
+                     (double)z->capacity_;
+      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold &&
+          !tail_usable && !filling) {
         /* If there is less than finish_threshold_% remaining capacity in a
          * non-open-zone, finish the zone */
         s = z->Finish();
@@ -610,9 +952,10 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
           Debug(logger_, "Failed finishing zone");
           return s;
         }
+        ZoneIOClass active_class = z->active_class_;
         s = z->CheckRelease();
         if (!s.ok()) return s;
-        PutActiveIOZoneToken();
+        PutActiveIOZoneToken(active_class);
       } else {
         s = z->CheckRelease();
         if (!s.ok()) return s;
@@ -623,9 +966,41 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
   return IOStatus::OK();
 }
 
-IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
+void ZonedBlockDevice::RecordAllocDemand(Env::WriteLifeTimeHint lifetime) {
+  std::lock_guard<std::mutex> lock(alloc_demand_mtx_);
+  for (auto &demand : alloc_demand_) demand *= 0.99;
+  if (lifetime <= Env::WLTH_EXTREME) alloc_demand_[lifetime] += 1;
+}
+
+double ZonedBlockDevice::GetAllocDemandShare(
+    Env::WriteLifeTimeHint lifetime) {
+  std::lock_guard<std::mutex> lock(alloc_demand_mtx_);
+  double total = 0;
+  for (auto demand : alloc_demand_) total += demand;
+  if (total == 0 || lifetime > Env::WLTH_EXTREME) return 0;
+  return alloc_demand_[lifetime] / total;
+}
+
+/* Cost of finishing a zone, in percent of a zone: the capacity that would
+ * be wasted, plus up to half a zone each if recent allocations ask for the
+ * lifetime of the zone and if the zone is filling up by itself. */
+double ZonedBlockDevice::GetFinishScore(Zone *zone) {
+  double waste = 100.0 * zone->capacity_ / zone->max_capacity_;
+  double demand = 50.0 * GetAllocDemandShare(zone->lifetime_);
+  double fill_s = zone->GetWriteRate() > 0
+                      ? zone->capacity_ / zone->GetWriteRate()
+                      : HUGE_VAL;
+  double filling = 50.0 / (1.0 + fill_s / ZONE_WRITE_RATE_WINDOW_S);
+
+  return waste + demand + filling;
+}
+
+IOStatus ZonedBlockDevice::FinishCheapestIOZone(bool *finished) {
   IOStatus s;
   Zone *finish_victim = nullptr;
+  double victim_score = 0;
+
+  if (finished != nullptr) *finished = false;
 
   for (const auto z : io_zones) {
     if (z->Acquire()) {
@@ -634,14 +1009,17 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
         if (!s.ok()) return s;
         continue;
       }
+      double score = GetFinishScore(z);
       if (finish_victim == nullptr) {
         finish_victim = z;
+        victim_score = score;
         continue;
       }
-      if (finish_victim->capacity_ > z->capacity_) {
+      if (victim_score > score) {
         s = finish_victim->CheckRelease();
         if (!s.ok()) return s;
         finish_victim = z;
+        victim_score = score;
       } else {
         s = z->CheckRelease();
         if (!s.ok()) return s;
@@ -655,11 +1033,13 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
     return IOStatus::OK();
   }
 
+  ZoneIOClass active_class = finish_victim->active_class_;
   s = finish_victim->Finish();
   IOStatus release_status = finish_victim->CheckRelease();
 
   if (s.ok()) {
-    PutActiveIOZoneToken();
+    PutActiveIOZoneToken(active_class);
+    if (finished != nullptr) *finished = true;
   }
 
   if (!release_status.ok()) {
@@ -669,9 +1049,24 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
   return s;
 }
 
-IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
-    Env::WriteLifeTimeHint file_lifetime, unsigned int *best_diff_out,
-    Zone **zone_out, uint32_t min_capacity) {
+/* Of two equally good lifetime matches, prefer the zone that fits the
+ * expected data in the least capacity. If neither fits, prefer the zone that
+ * can take the most data. */
+static bool IsBetterSizeFit(Zone *zone, Zone *other, uint64_t size_hint) {
+  bool fits = zone->capacity_ >= size_hint;
+  bool other_fits = other->capacity_ >= size_hint;
+
+  if (fits != other_fits) return fits;
+  if (fits) return zone->capacity_ < other->capacity_;
+  return zone->capacity_ > other->capacity_;
+}
+
+IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(const ZoneAllocContext &ctx,
+                                                unsigned int *best_diff_out,
+                                                Zone **zone_out,
+                                                uint32_t min_capacity) {
+  std::shared_ptr<ZoneAllocationPolicy> policy = GetAllocationPolicy();
+  uint64_t size_hint = ctx.size_hint;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   Zone *allocated_zone = nullptr;
   IOStatus s;
@@ -680,8 +1075,17 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
     if (z->Acquire()) {
       if ((z->used_capacity_ > 0) && !z->IsFull() &&
           z->capacity_ >= min_capacity) {
-        unsigned int diff = GetLifeTimeDiff(z->lifetime_, file_lifetime);
-        if (diff <= best_diff) {
+        unsigned int diff = policy->GetPlacementDiff(z, ctx);
+        bool better = diff <= best_diff;
+        if (diff == best_diff && allocated_zone != nullptr) {
+          /* FIFO groups fill their oldest zone first, so that the zones
+           * follow the file creation order */
+          if (ctx.placement_group & FIFO_PLACEMENT_GROUP)
+            better = z->first_write_time_ < allocated_zone->first_write_time_;
+          else if (size_hint > 0)
+            better = IsBetterSizeFit(z, allocated_zone, size_hint);
+        }
+        if (better) {
           if (allocated_zone != nullptr) {
             s = allocated_zone->CheckRelease();
             if (!s.ok()) {
@@ -709,32 +1113,183 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
   return IOStatus::OK();
 }
 
-IOStatus ZonedBlockDevice::AllocateEmptyZone(Zone **zone_out) {
+/* Must hold shared_zones_mtx_ */
+IOStatus ZonedBlockDevice::GetBestSharedZoneMatch(const ZoneAllocContext &ctx,
+                                                  Zone **zone_out) {
+  std::shared_ptr<ZoneAllocationPolicy> policy = GetAllocationPolicy();
+  /* Appends to shared zones are split over zones anyway */
+  ZoneAllocContext shared_ctx = ctx;
+  shared_ctx.size_hint = 0;
+  unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD + 1;
+  Zone *best_zone = nullptr;
+
+  /* Share zones with matching lifetimes as long as open zone tokens are
+   * available, but rather mix lifetimes than stall the writer */
+  bool out_of_open_zones =
+      open_io_zones_.load() >= (long)max_nr_open_io_zones_ - 1;
+
+  for (const auto &it : shared_zones_) {
+    Zone *z = it.first;
+    if (z->IsFull()) continue;
+    unsigned int diff = policy->GetPlacementDiff(z, shared_ctx);
+    if (diff < best_diff) {
+      best_zone = z;
+      best_diff = diff;
+    }
+  }
+
+  if (best_zone != nullptr && !out_of_open_zones &&
+      best_diff > LIFETIME_DIFF_COULD_BE_WORSE)
+    best_zone = nullptr;
+
+  *zone_out = best_zone;
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::AllocateSharedIOZone(
+    const ZoneAllocContext &ctx, Zone **out_zone,
+    const ZoneTokenDeadline &deadline) {
+  Zone *zone = nullptr;
   IOStatus s;
+
+  {
+    std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+    s = GetBestSharedZoneMatch(ctx, &zone);
+    if (!s.ok()) return s;
+    if (zone != nullptr) {
+      shared_zones_[zone]++;
+      ChargeActiveIOZoneToken(zone,
+                              GetZoneIOClass(ctx.io_type, ctx.write_hint));
+      *out_zone = zone;
+      return IOStatus::OK();
+    }
+  }
+
+  s = AllocateIOZone(ctx, &zone, ZoneAllocMode::kDefault, deadline);
+  if (!s.ok()) return s;
+
+  if (zone != nullptr) {
+    std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+    shared_zones_[zone] = 1;
+  }
+
+  *out_zone = zone;
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::ReleaseSharedIOZone(Zone *zone) {
+  {
+    std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+    auto it = shared_zones_.find(zone);
+
+    assert(it != shared_zones_.end());
+    if (it == shared_zones_.end())
+      return IOStatus::Corruption("Releasing a zone that is not shared");
+    if (--it->second > 0) return IOStatus::OK();
+    shared_zones_.erase(it);
+  }
+
+  /* The last writer is gone, close the zone as a file would */
+  bool full = zone->IsFull();
+  ZoneIOClass open_class = zone->open_class_;
+  ZoneIOClass active_class = zone->active_class_;
+  IOStatus s = zone->Close();
+  IOStatus release_status = zone->CheckRelease();
+  PutOpenIOZoneToken(open_class);
+  if (full) PutActiveIOZoneToken(active_class);
+
+  if (!s.ok()) return s;
+  return release_status;
+}
+
+IOStatus ZonedBlockDevice::GetBestTailMatch(const ZoneAllocContext &ctx,
+                                            Zone **zone_out) {
+  std::shared_ptr<ZoneAllocationPolicy> policy = GetAllocationPolicy();
+  uint64_t min_capacity = std::max(ctx.size_hint, (uint64_t)ZENFS_MIN_TAIL);
+  unsigned int best_diff = LIFETIME_DIFF_COULD_BE_WORSE;
   Zone *allocated_zone = nullptr;
+  IOStatus s;
+
   for (const auto z : io_zones) {
     if (z->Acquire()) {
-      if (z->IsEmpty()) {
+      bool better = false;
+      /* Only tails of zones the policy would place the file in, preferring
+       * the best placement and then the tightest fit */
+      if ((z->used_capacity_ > 0) && !z->IsFull() &&
+          z->capacity_ >= min_capacity) {
+        unsigned int diff = policy->GetPlacementDiff(z, ctx);
+        better = diff < best_diff ||
+                 (diff == best_diff &&
+                  (allocated_zone == nullptr ||
+                   z->capacity_ < allocated_zone->capacity_));
+        if (better) best_diff = diff;
+      }
+      if (better) {
+        if (allocated_zone != nullptr) {
+          s = allocated_zone->CheckRelease();
+          if (!s.ok()) {
+            IOStatus s_ = z->CheckRelease();
+            if (!s_.ok()) return s_;
+            return s;
+          }
+        }
         allocated_zone = z;
-        break;
       } else {
         s = z->CheckRelease();
         if (!s.ok()) return s;
       }
     }
   }
+
   *zone_out = allocated_zone;
   return IOStatus::OK();
 }
 
-int ZonedBlockDevice::DirectRead(char *buf, uint64_t offset, int n) {
+IOStatus ZonedBlockDevice::AllocateEmptyZone(Zone **zone_out) {
+  IOStatus s;
+  Zone *allocated_zone = nullptr;
+
+  while (true) {
+    bool resetting;
+    uint64_t zones_reset;
+    {
+      std::lock_guard<std::mutex> lock(mount_reset_mtx_);
+      resetting = mount_reset_running_;
+      zones_reset = zones_reset_;
+    }
+
+    for (const auto z : io_zones) {
+      if (z->Acquire()) {
+        if (z->IsEmpty()) {
+          allocated_zone = z;
+          break;
+        } else {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+        }
+      }
+    }
+    if (allocated_zone != nullptr || !resetting) break;
+
+    /* Unused zones are still being reset after mount, look again after the
+     * next batch */
+    std::unique_lock<std::mutex> lock(mount_reset_mtx_);
+    mount_reset_cv_.wait(lock, [&] {
+      return !mount_reset_running_ || zones_reset_ != zones_reset;
+    });
+  }
+
+  *zone_out = allocated_zone;
+  return IOStatus::OK();
+}
+
+int ZonedBlockDevice::Read(char *buf, uint64_t offset, int n, bool direct) {
   int ret = 0;
   int left = n;
   int r = -1;
-  int f = GetReadDirectFD();
 
   while (left) {
-    r = pread(f, buf, left, offset);
+    r = zbd_be_->Read(buf, left, offset, direct);
     if (r <= 0) {
       if (r == -1 && errno == EINTR) {
         continue;
@@ -767,15 +1322,25 @@ IOStatus ZonedBlockDevice::ReleaseMigrateZone(Zone *zone) {
 
 IOStatus ZonedBlockDevice::TakeMigrateZone(Zone **out_zone,
                                            Env::WriteLifeTimeHint file_lifetime,
+                                           uint32_t placement_group,
                                            uint32_t min_capacity) {
   std::unique_lock<std::mutex> lock(migrate_zone_mtx_);
   migrate_resource_.wait(lock, [this] { return !migrating_; });
 
   migrating_ = true;
 
+  ZoneAllocContext ctx;
+  ctx.lifetime = file_lifetime;
+  ctx.placement_group = placement_group;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
-  auto s =
-      GetBestOpenZoneMatch(file_lifetime, &best_diff, out_zone, min_capacity);
+  auto s = GetBestOpenZoneMatch(ctx, &best_diff, out_zone, min_capacity);
+  /* Zones the policy rules out, like the zones of a FIFO group, are never
+   * migrated to */
+  if (s.ok() && (*out_zone) != nullptr &&
+      best_diff >= LIFETIME_DIFF_NOT_GOOD) {
+    s = (*out_zone)->CheckRelease();
+    *out_zone = nullptr;
+  }
   if (s.ok() && (*out_zone) != nullptr) {
     Info(logger_, "TakeMigrateZone: %lu", (*out_zone)->start_);
   } else {
@@ -785,8 +1350,14 @@ IOStatus ZonedBlockDevice::TakeMigrateZone(Zone **out_zone,
   return s;
 }
 
-IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
-                                          IOType io_type, Zone **out_zone) {
+IOStatus ZonedBlockDevice::AllocateIOZone(const ZoneAllocContext &ctx,
+                                          Zone **out_zone,
+                                          ZoneAllocMode mode,
+                                          const ZoneTokenDeadline &deadline) {
+  Env::WriteLifeTimeHint file_lifetime = ctx.lifetime;
+  Env::WriteLifeTimeHint write_hint = ctx.write_hint;
+  IOType io_type = ctx.io_type;
+  uint32_t placement_group = ctx.placement_group;
   Zone *allocated_zone = nullptr;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   int new_zone = 0;
@@ -795,7 +1366,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
   auto tag = ZENFS_WAL_IO_ALLOC_LATENCY;
   if (io_type != IOType::kWAL) {
     // L0 flushes have lifetime MEDIUM
-    if (file_lifetime == Env::WLTH_MEDIUM) {
+    if (write_hint == Env::WLTH_MEDIUM) {
       tag = ZENFS_L0_IO_ALLOC_LATENCY;
     } else {
       tag = ZENFS_NON_WAL_IO_ALLOC_LATENCY;
@@ -804,6 +1375,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
 
   ZenFSMetricsLatencyGuard guard(metrics_, tag, Env::Default());
   metrics_->ReportQPS(ZENFS_IO_ALLOC_QPS, 1);
+  RecordAllocDemand(file_lifetime);
 
   // Check if a deferred IO error was set
   s = GetZoneDeferredStatus();
@@ -811,41 +1383,70 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
     return s;
   }
 
-  if (io_type != IOType::kWAL) {
+  /* Classify by the kind of write, not by the predicted lifetime */
+  ZoneIOClass io_class = GetZoneIOClass(io_type, write_hint);
+  s = WaitForOpenIOZoneToken(io_class, deadline);
+  if (!s.ok()) return s;
+
+  /* Switch to a pre-opened zone right away if there is one */
+  if (mode == ZoneAllocMode::kDefault &&
+      !(placement_group & FIFO_PLACEMENT_GROUP)) {
+    allocated_zone = TakePooledZone(io_class);
+    if (allocated_zone != nullptr) {
+      allocated_zone->lifetime_ = file_lifetime;
+      allocated_zone->placement_group_ = placement_group;
+      MarkZoneMetaDirty(allocated_zone);
+      best_diff = 0;
+      new_zone = true;
+    }
+  }
+
+  if (io_type != IOType::kWAL && allocated_zone == nullptr) {
     s = ApplyFinishThreshold();
     if (!s.ok()) {
+      PutOpenIOZoneToken(io_class);
       return s;
     }
   }
 
-  WaitForOpenIOZoneToken(io_type == IOType::kWAL);
+  /* Pack small files into the tails of partially written zones */
+  if (mode == ZoneAllocMode::kTail) {
+    s = GetBestTailMatch(ctx, &allocated_zone);
+    if (!s.ok()) {
+      PutOpenIOZoneToken(io_class);
+      return s;
+    }
+    if (allocated_zone != nullptr) best_diff = 0;
+  }
 
   /* Try to fill an already open zone(with the best life time diff) */
-  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone);
-  if (!s.ok()) {
-    PutOpenIOZoneToken();
-    return s;
+  if (mode != ZoneAllocMode::kDedicated && allocated_zone == nullptr) {
+    s = GetBestOpenZoneMatch(ctx, &best_diff, &allocated_zone);
+    if (!s.ok()) {
+      PutOpenIOZoneToken(io_class);
+      return s;
+    }
   }
 
   // Holding allocated_zone if != nullptr
 
   if (best_diff >= LIFETIME_DIFF_COULD_BE_WORSE) {
-    bool got_token = GetActiveIOZoneTokenIfAvailable();
+    bool got_token = GetActiveIOZoneTokenIfAvailable(io_class);
 
     /* If we did not get a token, try to use the best match, even if the life
      * time diff not good but a better choice than to finish an existing zone
      * and open a new one
      */
     if (allocated_zone != nullptr) {
-      if (!got_token && best_diff == LIFETIME_DIFF_COULD_BE_WORSE) {
+      if (!got_token && best_diff < LIFETIME_DIFF_NOT_GOOD) {
         Debug(logger_,
               "Allocator: avoided a finish by relaxing lifetime diff "
               "requirement\n");
       } else {
         s = allocated_zone->CheckRelease();
         if (!s.ok()) {
-          PutOpenIOZoneToken();
-          if (got_token) PutActiveIOZoneToken();
+          PutOpenIOZoneToken(io_class);
+          if (got_token) PutActiveIOZoneToken(io_class);
           return s;
         }
         allocated_zone = nullptr;
@@ -855,39 +1456,60 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
     /* If we haven't found an open zone to fill, open a new zone */
     if (allocated_zone == nullptr) {
       /* We have to make sure we can open an empty zone */
-      while (!got_token && !GetActiveIOZoneTokenIfAvailable()) {
-        s = FinishCheapestIOZone();
+      bool borrow = false;
+      while (!got_token &&
+             !GetActiveIOZoneTokenIfAvailable(io_class, borrow)) {
+        bool finished;
+        s = FinishCheapestIOZone(&finished);
         if (!s.ok()) {
-          PutOpenIOZoneToken();
+          PutOpenIOZoneToken(io_class);
           return s;
         }
+        /* Nothing left to finish, the remaining tokens are pooled or held
+         * back for other classes. Take one of them rather than spin. */
+        if (!finished) {
+          got_token = TakePooledZoneToken(io_class);
+          if (!got_token) borrow = true;
+        }
+        if (!got_token && std::chrono::steady_clock::now() >= deadline) {
+          PutOpenIOZoneToken(io_class);
+          metrics_->ReportQPS(
+              ClassLabel(ZENFS_WAL_ZONE_TOKEN_TIMEOUT_QPS, io_class), 1);
+          return ZoneTokenTimedOut();
+        }
       }
 
       s = AllocateEmptyZone(&allocated_zone);
       if (!s.ok()) {
-        PutActiveIOZoneToken();
-        PutOpenIOZoneToken();
+        PutActiveIOZoneToken(io_class);
+        PutOpenIOZoneToken(io_class);
         return s;
       }
 
       if (allocated_zone != nullptr) {
         assert(allocated_zone->IsBusy());
         allocated_zone->lifetime_ = file_lifetime;
+        allocated_zone->placement_group_ = placement_group;
+        MarkZoneMetaDirty(allocated_zone);
+        allocated_zone->active_class_ = io_class;
         new_zone = true;
       } else {
-        PutActiveIOZoneToken();
+        PutActiveIOZoneToken(io_class);
       }
     }
   }
 
   if (allocated_zone) {
     assert(allocated_zone->IsBusy());
+    allocated_zone->open_class_ = io_class;
+    if (!new_zone) ChargeActiveIOZoneToken(allocated_zone, io_class);
     Debug(logger_,
-          "Allocating zone(new=%d) start: 0x%lx wp: 0x%lx lt: %d file lt: %d\n",
+          "Allocating zone(new=%d) start: 0x%lx wp: 0x%lx lt: %d file lt: %d "
+          "group: %u\n",
           new_zone, allocated_zone->start_, allocated_zone->wp_,
-          allocated_zone->lifetime_, file_lifetime);
+          allocated_zone->lifetime_, file_lifetime, placement_group);
   } else {
-    PutOpenIOZoneToken();
+    PutOpenIOZoneToken(io_class);
   }
 
   if (io_type != IOType::kWAL) {
@@ -902,7 +1524,79 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
   return IOStatus::OK();
 }
 
-std::string ZonedBlockDevice::GetFilename() { return filename_; }
+static void EncodeZoneMeta(Zone *z, std::string *output) {
+  std::string zone_meta;
+
+  PutFixed64(&zone_meta, z->start_);
+  PutFixed32(&zone_meta, (uint32_t)z->lifetime_);
+  PutFixed64(&zone_meta, (uint64_t)z->first_write_time_);
+  PutFixed32(&zone_meta, z->placement_group_);
+  PutLengthPrefixedSlice(output, Slice(zone_meta));
+}
+
+void ZonedBlockDevice::EncodeZoneMetaTo(std::string *output, bool dirty_only,
+                                        std::vector<Zone *> *encoded) {
+  /* A snapshot leaves the flags alone, so a failed roll loses nothing */
+  if (!dirty_only) {
+    for (const auto z : io_zones) {
+      if (!z->IsEmpty()) EncodeZoneMeta(z, output);
+    }
+    return;
+  }
+
+  std::vector<Zone *> dirty;
+  {
+    std::lock_guard<std::mutex> lock(dirty_meta_mtx_);
+    dirty.swap(dirty_meta_zones_);
+  }
+
+  /* The flag is cleared before the fields are read, a concurrent change
+   * lists the zone again */
+  for (const auto z : dirty) {
+    if (!z->meta_dirty_.exchange(false) || z->IsEmpty()) continue;
+    EncodeZoneMeta(z, output);
+    if (encoded != nullptr) encoded->push_back(z);
+  }
+}
+
+void ZonedBlockDevice::MarkZoneMetaDirty(Zone *zone) {
+  if (zone->meta_dirty_.exchange(true)) return;
+  std::lock_guard<std::mutex> lock(dirty_meta_mtx_);
+  dirty_meta_zones_.push_back(zone);
+}
+
+void ZonedBlockDevice::MarkZoneMetaDirty(const std::vector<Zone *> &zones) {
+  for (const auto z : zones) MarkZoneMetaDirty(z);
+}
+
+Status ZonedBlockDevice::DecodeZoneMetaFrom(Slice *input) {
+  Slice zone_meta;
+
+  while (GetLengthPrefixedSlice(input, &zone_meta)) {
+    uint64_t start, first_write_time;
+    uint32_t lifetime, placement_group;
+
+    if (!GetFixed64(&zone_meta, &start) || !GetFixed32(&zone_meta, &lifetime) ||
+        !GetFixed64(&zone_meta, &first_write_time) ||
+        !GetFixed32(&zone_meta, &placement_group))
+      return Status::Corruption("Zone meta data", "Missing zone fields");
+
+    /* Zones that have been reset since are empty and get new placement
+     * meta data when allocated again. Trailing fields are ignored to allow
+     * for future additions. */
+    Zone *zone = GetIOZone(start);
+    if (zone == nullptr || zone->start_ != start || zone->IsEmpty()) continue;
+
+    if (lifetime > Env::WLTH_EXTREME) lifetime = Env::WLTH_NOT_SET;
+    zone->lifetime_ = (Env::WriteLifeTimeHint)lifetime;
+    zone->first_write_time_ = (time_t)first_write_time;
+    zone->placement_group_ = placement_group;
+  }
+
+  return Status::OK();
+}
+
+std::string ZonedBlockDevice::GetFilename() { return zbd_be_->GetFilename(); }
 
 uint32_t ZonedBlockDevice::GetBlockSize() { return block_sz_; }
 
@@ -938,7 +1632,7 @@ IOStatus ZonedBlockDevice::GetZoneDeferredStatus() {
 
 void ZonedBlockDevice::SetZoneDeferredStatus(IOStatus status) {
   std::lock_guard<std::mutex> lk(zone_deferred_status_mutex_);
-  if (!zone_deferred_status_.ok()) {
+  if (zone_deferred_status_.ok()) {
     zone_deferred_status_ = status;
   }
 }
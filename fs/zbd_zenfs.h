@@ -10,7 +10,6 @@
 #if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
 
 #include <errno.h>
-#include <libzbd/zbd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -18,47 +17,105 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "backend_zenfs.h"
+#include "bufpool_zenfs.h"
+#include "lifetime_zenfs.h"
 #include "metrics.h"
+#include "policy_zenfs.h"
+#include "scheduler_zenfs.h"
 #include "rocksdb/env.h"
 #include "rocksdb/file_system.h"
 #include "rocksdb/io_status.h"
 
 namespace ROCKSDB_NAMESPACE {
 
+/* Placement groups with this bit set hold files that are deleted in the order
+ * they were created. Their files are written to zones of their own, in
+ * creation order. */
+#define FIFO_PLACEMENT_GROUP (1u << 31)
+
+/* How the allocator picks a zone for a file:
+ * kDefault: the open zone with the best lifetime match, or a new zone
+ * kDedicated: always an empty zone, see ZenFS::SetZoneSizedFiles
+ * kTail: the partially written zone with the least capacity left that fits
+ *        the file, for small files */
+enum class ZoneAllocMode { kDefault, kDedicated, kTail };
+
 class ZonedBlockDevice;
 class ZoneSnapshot;
 class ZenFSSnapshotOptions;
 
+/* Zones are scanned by every allocation, while extents update their used
+ * capacity from many threads. The fields the scans read and the used
+ * capacity each start a cache line of their own, and zones never share a
+ * cache line. */
+#define ZENFS_CACHE_LINE_SIZE (64)
+
 class Zone {
   ZonedBlockDevice *zbd_;
-  std::atomic_bool busy_;
+  /* Serializes appends to a zone shared by several files */
+  std::mutex append_mtx_;
 
  public:
-  explicit Zone(ZonedBlockDevice *zbd, struct zbd_zone *z);
+  explicit Zone(ZonedBlockDevice *zbd, const ZoneInfo &z);
 
   uint64_t start_;
-  uint64_t capacity_; /* remaining capacity */
   uint64_t max_capacity_;
+  time_t first_write_time_;
+  /* Bytes written per second, averaged over ZONE_WRITE_RATE_WINDOW_S */
+  double write_rate_;
+  uint64_t write_rate_time_us_;
+
+ private:
+  alignas(ZENFS_CACHE_LINE_SIZE) std::atomic_bool busy_;
+
+ public:
+  uint64_t capacity_; /* remaining capacity */
   uint64_t wp_;
   Env::WriteLifeTimeHint lifetime_;
-  std::atomic<uint64_t> used_capacity_;
+  /* Set at allocation, read by the allocation policy without a lock */
+  std::atomic<uint32_t> placement_group_;
+  /* Classes charged for the open and active zone tokens held by the zone */
+  ZoneIOClass open_class_;
+  ZoneIOClass active_class_;
+  /* Placement metadata changed since it was last persisted, set through
+   * ZonedBlockDevice::MarkZoneMetaDirty */
+  std::atomic<bool> meta_dirty_;
+
+  alignas(ZENFS_CACHE_LINE_SIZE) std::atomic<uint64_t> used_capacity_;
 
   IOStatus Reset();
+  /* Reset the zone state after the device has reset the zone */
+  void ResetState();
+  /* Pick up a zone going offline or read only from the device */
+  void RefreshState();
   IOStatus Finish();
   IOStatus Close();
 
   IOStatus Append(char *data, uint32_t size);
+  /* Append to a zone shared by several files. Appends are serialized and
+   * land at the write pointer, which is returned in offset. Only as much as
+   * the zone capacity allows is written, zero bytes if the zone is full. */
+  IOStatus SequencedAppend(char *data, uint32_t size, uint32_t *written,
+                           uint64_t *offset);
   bool IsUsed();
   bool IsFull();
   bool IsEmpty();
   uint64_t GetZoneNr();
   uint64_t GetCapacityLeft();
+  /* Recent write rate in bytes per second, decayed to now */
+  double GetWriteRate();
   bool IsBusy() { return this->busy_.load(std::memory_order_relaxed); }
   bool Acquire() {
     bool expected = false;
@@ -78,30 +135,39 @@ class Zone {
 
 class ZonedBlockDevice {
  private:
-  std::string filename_;
+  std::unique_ptr<ZonedBlockDeviceBackend> zbd_be_;
   uint32_t block_sz_;
   uint64_t zone_sz_;
   uint32_t nr_zones_;
+  /* All zones live in one array, in device order, which io_zones and
+   * meta_zones point into */
+  Zone *zones_ = nullptr;
+  uint32_t zones_constructed_ = 0;
+  uint32_t zones_allocated_ = 0;
   std::vector<Zone *> io_zones;
   std::vector<Zone *> meta_zones;
-  int read_f_;
-  int read_direct_f_;
-  int write_f_;
+  /* Io zones by zone number, nullptr for meta, offline and conventional
+   * zones */
+  std::vector<Zone *> io_zone_index_;
   time_t start_time_;
   std::shared_ptr<Logger> logger_;
-  uint32_t finish_threshold_ = 0;
+  std::atomic<uint32_t> finish_threshold_{0};
   std::atomic<uint64_t> bytes_written_{0};
   std::atomic<uint64_t> gc_bytes_written_{0};
 
   std::atomic<long> active_io_zones_;
   std::atomic<long> open_io_zones_;
-  /* Protects zone_resuorces_  condition variable, used
-     for notifying changes in open_io_zones_ */
-  std::mutex zone_resources_mtx_;
-  std::condition_variable zone_resources_;
+  /* Hand out the open and active zone tokens counted above */
+  ZoneTokenScheduler open_zone_scheduler_;
+  ZoneTokenScheduler active_zone_scheduler_;
   std::mutex zone_deferred_status_mutex_;
   IOStatus zone_deferred_status_;
 
+  /* Zones with meta_dirty_ set, so that metadata syncs don't scan all zones.
+   * A zone may be listed more than once. */
+  std::mutex dirty_meta_mtx_;
+  std::vector<Zone *> dirty_meta_zones_;
+
   std::condition_variable migrate_resource_;
   std::mutex migrate_zone_mtx_;
   std::atomic<bool> migrating_{false};
@@ -111,6 +177,77 @@ class ZonedBlockDevice {
 
   std::shared_ptr<ZenFSMetrics> metrics_;
 
+  WriteBufferPool write_buffer_pool_;
+
+  LifetimePredictor lifetime_predictor_;
+
+  /* Picks open zones for files, replaced with std::atomic_store */
+  std::shared_ptr<ZoneAllocationPolicy> alloc_policy_ =
+      std::make_shared<DefaultZoneAllocationPolicy>();
+
+  /* Zones appended to by several files through the zone write sequencer,
+   * mapped to their number of writers. A shared zone stays acquired and
+   * holds its open zone token until the last writer releases it. */
+  std::mutex shared_zones_mtx_;
+  std::map<Zone *, uint32_t> shared_zones_;
+
+  /* Empty zones set aside for the latency critical classes, so that a WAL
+   * or flush file crossing a zone boundary does not have to run the
+   * allocator. Pooled zones are acquired and hold an active zone token of
+   * their class. */
+  std::mutex zone_pool_mtx_;
+  std::condition_variable zone_pool_cv_;
+  std::vector<Zone *> zone_pools_[ZONE_IO_CLASS_NR];
+  uint32_t zone_pool_size_[ZONE_IO_CLASS_NR] = {1 /* WAL */, 1 /* flush */};
+  bool zone_pool_stop_ = false;
+  std::unique_ptr<std::thread> zone_pool_worker_;
+
+  void ZonePoolWorker();
+  void StopZonePools();
+
+  /* Unused zones left by the last mount are reset in the background.
+   * zones_reset_ counts the reset batches, so that allocations waiting for
+   * an empty zone can tell when to look again. */
+  std::mutex mount_reset_mtx_;
+  std::condition_variable mount_reset_cv_;
+  bool mount_reset_running_ = false;
+  bool mount_reset_stop_ = false;
+  uint64_t zones_reset_ = 0;
+  std::unique_ptr<std::thread> mount_reset_worker_;
+
+  void MountResetWorker();
+  void StopMountReset();
+  void NotifyZonesReset();
+
+  /* Write full buffers of buffered files in the background, shared by all
+   * files. The workers are started by the first write and run the queued
+   * writes highest priority class first. */
+  std::mutex write_behind_mtx_;
+  std::condition_variable write_behind_cv_;
+  std::deque<std::function<void()>> write_behind_queues_[ZONE_IO_CLASS_NR];
+  bool write_behind_stop_ = false;
+  std::vector<std::thread> write_behind_workers_;
+
+  void WriteBehindWorker();
+  void StopWriteBehind();
+
+  IOStatus CloseZones(const std::vector<Zone *> &zones);
+  Zone *NewZone(const ZoneInfo &z);
+  void FreeZones();
+  Zone *TakePooledZone(ZoneIOClass io_class);
+  Zone *PopPooledZone(ZoneIOClass *io_class);
+  bool ReleasePooledZone();
+  bool TakePooledZoneToken(ZoneIOClass io_class);
+
+  /* Recent allocations per lifetime, decaying with every allocation. Tells
+   * which zones upcoming allocations are likely to reuse. */
+  std::mutex alloc_demand_mtx_;
+  double alloc_demand_[Env::WLTH_EXTREME + 1] = {};
+
+  void RecordAllocDemand(Env::WriteLifeTimeHint lifetime);
+  double GetAllocDemandShare(Env::WriteLifeTimeHint lifetime);
+  double GetFinishScore(Zone *zone);
+
   void EncodeJsonZone(std::ostream &json_stream,
                       const std::vector<Zone *> zones);
 
@@ -119,32 +256,56 @@ class ZonedBlockDevice {
                             std::shared_ptr<Logger> logger,
                             std::shared_ptr<ZenFSMetrics> metrics =
                                 std::make_shared<NoZenFSMetrics>());
+  explicit ZonedBlockDevice(std::unique_ptr<ZonedBlockDeviceBackend> backend,
+                            std::shared_ptr<Logger> logger,
+                            std::shared_ptr<ZenFSMetrics> metrics =
+                                std::make_shared<NoZenFSMetrics>());
   virtual ~ZonedBlockDevice();
 
   IOStatus Open(bool readonly, bool exclusive);
-  IOStatus CheckScheduler();
 
+  /* The io zone holding offset, nullptr if there is none */
   Zone *GetIOZone(uint64_t offset);
 
-  IOStatus AllocateIOZone(Env::WriteLifeTimeHint file_lifetime, IOType io_type,
-                          Zone **out_zone);
+  /* size_hint is the expected amount of data still to be written by the
+   * file, 0 if unknown. Returns a retryable TimedOut status if no zone could
+   * be allocated before the deadline. */
+  IOStatus AllocateIOZone(
+      const ZoneAllocContext &ctx, Zone **out_zone,
+      ZoneAllocMode mode = ZoneAllocMode::kDefault,
+      const ZoneTokenDeadline &deadline = ZONE_TOKEN_NO_DEADLINE);
+  /* Allocate a zone to append to through the zone write sequencer, joining
+   * a zone other files are writing to if the lifetimes match or if we are
+   * out of open zones */
+  IOStatus AllocateSharedIOZone(
+      const ZoneAllocContext &ctx, Zone **out_zone,
+      const ZoneTokenDeadline &deadline = ZONE_TOKEN_NO_DEADLINE);
+  IOStatus ReleaseSharedIOZone(Zone *zone);
   IOStatus AllocateMetaZone(Zone **out_meta_zone);
 
   uint64_t GetFreeSpace();
   uint64_t GetUsedSpace();
+  /* Smallest capacity of an io zone when empty */
+  uint64_t GetUsableZoneCapacity();
   uint64_t GetReclaimableSpace();
 
   std::string GetFilename();
   uint32_t GetBlockSize();
 
   IOStatus ResetUnusedIOZones();
+  IOStatus ResetUnusedIOZones(const std::vector<Zone *> &zones);
+  /* Reset busy, unused zones and release them. Contiguous zones are reset
+   * with a single request. */
+  IOStatus ResetZones(std::vector<Zone *> &zones);
   void LogZoneStats();
   void LogZoneUsage();
   void LogGarbageInfo();
 
-  int GetReadFD() { return read_f_; }
-  int GetReadDirectFD() { return read_direct_f_; }
-  int GetWriteFD() { return write_f_; }
+  ZonedBlockDeviceBackend *GetBackend() { return zbd_be_.get(); }
+  WriteBufferPool *GetWriteBufferPool() { return &write_buffer_pool_; }
+  /* Run a write on the write behind workers. The write must not wait for
+   * zone tokens, the workers are shared by all files. */
+  void ScheduleWriteBehind(ZoneIOClass io_class, std::function<void()> write);
 
   uint64_t GetZoneSize() { return zone_sz_; }
   uint32_t GetNrZones() { return nr_zones_; }
@@ -152,8 +313,26 @@ class ZonedBlockDevice {
 
   void SetFinishTreshold(uint32_t threshold) { finish_threshold_ = threshold; }
 
-  void PutOpenIOZoneToken();
-  void PutActiveIOZoneToken();
+  void PutOpenIOZoneToken(ZoneIOClass io_class);
+  void PutActiveIOZoneToken(ZoneIOClass io_class);
+  /* Charge the active zone token of a zone written by another class to that
+   * class from now on */
+  void ChargeActiveIOZoneToken(Zone *zone, ZoneIOClass io_class);
+
+  void SetZoneIOClassOptions(ZoneIOClass io_class,
+                             const ZoneIOClassOptions &options);
+
+  /* Reset the unused io zones in the background. Allocating an empty zone
+   * waits for the resets in progress if no zone is empty yet. Errors are
+   * reported through the deferred zone status. */
+  void StartMountReset();
+
+  /* Start refilling the pools of empty zones in the background */
+  void StartZonePools();
+  /* Stop the mount time resets and the zone pool refills, must be done
+   * before the files are dropped, as the zones would look unused */
+  void StopBackgroundWork();
+  void SetZonePoolSize(ZoneIOClass io_class, uint32_t size);
 
   void EncodeJson(std::ostream &json_stream);
 
@@ -161,14 +340,38 @@ class ZonedBlockDevice {
 
   std::shared_ptr<ZenFSMetrics> GetMetrics() { return metrics_; }
 
+  LifetimePredictor &GetLifetimePredictor() { return lifetime_predictor_; }
+
+  void SetAllocationPolicy(std::shared_ptr<ZoneAllocationPolicy> policy) {
+    std::atomic_store(&alloc_policy_, policy);
+  }
+  std::shared_ptr<ZoneAllocationPolicy> GetAllocationPolicy() {
+    return std::atomic_load(&alloc_policy_);
+  }
+
   void GetZoneSnapshot(std::vector<ZoneSnapshot> &snapshot);
 
-  int DirectRead(char *buf, uint64_t offset, int n);
+  /* Placement metadata of written zones, persisted in the meta log so that
+   * zone lifetimes survive a remount. With dirty_only set, the dirty flags
+   * of the encoded zones are cleared and the zones added to encoded; hand
+   * them to MarkZoneMetaDirty if the record could not be persisted. */
+  void EncodeZoneMetaTo(std::string *output, bool dirty_only,
+                        std::vector<Zone *> *encoded = nullptr);
+  void MarkZoneMetaDirty(Zone *zone);
+  void MarkZoneMetaDirty(const std::vector<Zone *> &zones);
+  Status DecodeZoneMetaFrom(Slice *input);
+
+  /* Reads n bytes, less only at the end of the device. Returns the bytes
+   * read or -1 with errno set. */
+  int Read(char *buf, uint64_t offset, int n, bool direct);
+  int DirectRead(char *buf, uint64_t offset, int n) {
+    return Read(buf, offset, n, true);
+  }
 
   IOStatus ReleaseMigrateZone(Zone *zone);
 
   IOStatus TakeMigrateZone(Zone **out_zone, Env::WriteLifeTimeHint lifetime,
-                           uint32_t min_capacity);
+                           uint32_t placement_group, uint32_t min_capacity);
 
   void AddBytesWritten(uint64_t written) { bytes_written_ += written; };
   void AddGCBytesWritten(uint64_t written) { gc_bytes_written_ += written; };
@@ -178,15 +381,19 @@ class ZonedBlockDevice {
   uint64_t GetTotalBytesWritten() { return bytes_written_.load(); };
 
  private:
-  std::string ErrorToString(int err);
   IOStatus GetZoneDeferredStatus();
-  bool GetActiveIOZoneTokenIfAvailable();
-  void WaitForOpenIOZoneToken(bool prioritized);
+  bool GetActiveIOZoneTokenIfAvailable(ZoneIOClass io_class,
+                                       bool borrow = false);
+  IOStatus WaitForOpenIOZoneToken(ZoneIOClass io_class,
+                                  const ZoneTokenDeadline &deadline);
   IOStatus ApplyFinishThreshold();
-  IOStatus FinishCheapestIOZone();
-  IOStatus GetBestOpenZoneMatch(Env::WriteLifeTimeHint file_lifetime,
+  IOStatus FinishCheapestIOZone(bool *finished = nullptr);
+  IOStatus GetBestOpenZoneMatch(const ZoneAllocContext &ctx,
                                 unsigned int *best_diff_out, Zone **zone_out,
                                 uint32_t min_capacity = 0);
+  IOStatus GetBestSharedZoneMatch(const ZoneAllocContext &ctx,
+                                  Zone **zone_out);
+  IOStatus GetBestTailMatch(const ZoneAllocContext &ctx, Zone **zone_out);
   IOStatus AllocateEmptyZone(Zone **zone_out);
 };
 
@@ -0,0 +1,204 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include "zbdlib_zenfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libzbd/zbd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace ROCKSDB_NAMESPACE {
+
+ZbdlibBackend::ZbdlibBackend(std::string bdevname)
+    : filename_("/dev/" + bdevname),
+      read_f_(-1),
+      read_direct_f_(-1),
+      write_f_(-1) {}
+
+ZbdlibBackend::~ZbdlibBackend() {
+  if (read_f_ >= 0) zbd_close(read_f_);
+  if (read_direct_f_ >= 0) zbd_close(read_direct_f_);
+  if (write_f_ >= 0) zbd_close(write_f_);
+}
+
+std::string ZbdlibBackend::ErrorToString(int err) {
+  char *err_str = strerror(err);
+  if (err_str != nullptr) return std::string(err_str);
+  return "";
+}
+
+IOStatus ZbdlibBackend::CheckScheduler() {
+  std::ostringstream path;
+  std::string s = filename_;
+  std::fstream f;
+
+  s.erase(0, 5);  // Remove "/dev/" from /dev/nvmeXnY
+  path << "/sys/block/" << s << "/queue/scheduler";
+  f.open(path.str(), std::fstream::in);
+  if (!f.is_open()) {
+    return IOStatus::InvalidArgument("Failed to open " + path.str());
+  }
+
+  std::string buf;
+  getline(f, buf);
+  if (buf.find("[mq-deadline]") == std::string::npos) {
+    f.close();
+    return IOStatus::InvalidArgument(
+        "Current ZBD scheduler is not mq-deadline, set it to mq-deadline.");
+  }
+
+  f.close();
+  return IOStatus::OK();
+}
+
+IOStatus ZbdlibBackend::Open(bool readonly, bool exclusive) {
+  zbd_info info;
+
+  /* The non-direct file descriptor acts as an exclusive-use semaphore */
+  if (exclusive) {
+    read_f_ = zbd_open(filename_.c_str(), O_RDONLY | O_EXCL, &info);
+  } else {
+    read_f_ = zbd_open(filename_.c_str(), O_RDONLY, &info);
+  }
+
+  if (read_f_ < 0) {
+    return IOStatus::InvalidArgument(
+        "Failed to open zoned block device for read: " + ErrorToString(errno));
+  }
+
+  read_direct_f_ = zbd_open(filename_.c_str(), O_RDONLY | O_DIRECT, &info);
+  if (read_direct_f_ < 0) {
+    return IOStatus::InvalidArgument(
+        "Failed to open zoned block device for direct read: " +
+        ErrorToString(errno));
+  }
+
+  if (readonly) {
+    write_f_ = -1;
+  } else {
+    write_f_ = zbd_open(filename_.c_str(), O_WRONLY | O_DIRECT, &info);
+    if (write_f_ < 0) {
+      return IOStatus::InvalidArgument(
+          "Failed to open zoned block device for write: " +
+          ErrorToString(errno));
+    }
+  }
+
+  if (info.model != ZBD_DM_HOST_MANAGED) {
+    return IOStatus::NotSupported("Not a host managed block device");
+  }
+
+  IOStatus ios = CheckScheduler();
+  if (ios != IOStatus::OK()) return ios;
+
+  block_sz_ = info.pblock_size;
+  zone_sz_ = info.zone_size;
+  nr_zones_ = info.nr_zones;
+  max_active_zones_ = info.max_nr_active_zones;
+  max_open_zones_ = info.max_nr_open_zones;
+
+  return IOStatus::OK();
+}
+
+static void ToZoneInfo(struct zbd_zone *z, ZoneInfo *zone) {
+  zone->start = zbd_zone_start(z);
+  zone->capacity = zbd_zone_capacity(z);
+  zone->wp = zbd_zone_wp(z);
+  zone->seq_write_required = zbd_zone_type(z) == ZBD_ZONE_TYPE_SWR;
+  zone->offline = zbd_zone_offline(z);
+  zone->full = zbd_zone_full(z);
+  zone->readonly = zbd_zone_rdonly(z);
+  zone->open = zbd_zone_imp_open(z) || zbd_zone_exp_open(z);
+  zone->closed = zbd_zone_closed(z);
+}
+
+IOStatus ZbdlibBackend::ListZones(std::vector<ZoneInfo> *zones) {
+  struct zbd_zone *zone_rep;
+  unsigned int reported_zones;
+  uint64_t addr_space_sz = (uint64_t)nr_zones_ * zone_sz_;
+  int ret;
+
+  ret = zbd_list_zones(read_f_, 0, addr_space_sz, ZBD_RO_ALL, &zone_rep,
+                       &reported_zones);
+  if (ret || reported_zones != nr_zones_) {
+    if (ret == 0) free(zone_rep);
+    return IOStatus::IOError("Failed to list zones, err: " +
+                             std::to_string(ret));
+  }
+
+  zones->resize(reported_zones);
+  for (unsigned int i = 0; i < reported_zones; i++)
+    ToZoneInfo(&zone_rep[i], &(*zones)[i]);
+
+  free(zone_rep);
+  return IOStatus::OK();
+}
+
+IOStatus ZbdlibBackend::ReportZones(uint64_t start, uint32_t nr_zones,
+                                    std::vector<ZoneInfo> *zones) {
+  std::vector<struct zbd_zone> zone_rep(nr_zones);
+  unsigned int report = nr_zones;
+  int ret;
+
+  ret = zbd_report_zones(read_f_, start, (uint64_t)nr_zones * zone_sz_,
+                         ZBD_RO_ALL, zone_rep.data(), &report);
+  if (ret || (report != nr_zones))
+    return IOStatus::IOError("Zone report failed\n");
+
+  zones->resize(nr_zones);
+  for (uint32_t i = 0; i < nr_zones; i++)
+    ToZoneInfo(&zone_rep[i], &(*zones)[i]);
+  return IOStatus::OK();
+}
+
+IOStatus ZbdlibBackend::Reset(uint64_t start, uint32_t nr_zones) {
+  int ret = zbd_reset_zones(write_f_, start, (uint64_t)nr_zones * zone_sz_);
+  if (ret) return IOStatus::IOError("Zone reset failed\n");
+  return IOStatus::OK();
+}
+
+IOStatus ZbdlibBackend::Finish(uint64_t start) {
+  int ret = zbd_finish_zones(write_f_, start, zone_sz_);
+  if (ret) return IOStatus::IOError("Zone finish failed\n");
+  return IOStatus::OK();
+}
+
+IOStatus ZbdlibBackend::Close(uint64_t start) {
+  int ret = zbd_close_zones(write_f_, start, zone_sz_);
+  if (ret) return IOStatus::IOError("Zone close failed\n");
+  return IOStatus::OK();
+}
+
+int ZbdlibBackend::Read(char *buf, int size, uint64_t pos, bool direct) {
+  return pread(direct ? read_direct_f_ : read_f_, buf, size, pos);
+}
+
+int ZbdlibBackend::Write(const char *data, uint32_t size, uint64_t pos) {
+  return pwrite(write_f_, data, size, pos);
+}
+
+bool ZbdlibBackend::GetDeviceId(uint64_t *dev, uint64_t *ino) {
+  struct stat buf;
+
+  if (fstat(read_f_, &buf) == -1) return false;
+  *dev = buf.st_dev;
+  *ino = buf.st_ino;
+  return true;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,49 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <string>
+#include <vector>
+
+#include "backend_zenfs.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Zoned block device managed through libzbd */
+class ZbdlibBackend : public ZonedBlockDeviceBackend {
+ private:
+  std::string filename_;
+  int read_f_;
+  int read_direct_f_;
+  int write_f_;
+
+  std::string ErrorToString(int err);
+  IOStatus CheckScheduler();
+
+ public:
+  explicit ZbdlibBackend(std::string bdevname);
+  ~ZbdlibBackend();
+
+  IOStatus Open(bool readonly, bool exclusive) override;
+  IOStatus ListZones(std::vector<ZoneInfo> *zones) override;
+  IOStatus ReportZones(uint64_t start, uint32_t nr_zones,
+                       std::vector<ZoneInfo> *zones) override;
+  IOStatus Reset(uint64_t start, uint32_t nr_zones) override;
+  IOStatus Finish(uint64_t start) override;
+  IOStatus Close(uint64_t start) override;
+  int Read(char *buf, int size, uint64_t pos, bool direct) override;
+  int Write(const char *data, uint32_t size, uint64_t pos) override;
+  bool GetDeviceId(uint64_t *dev, uint64_t *ino) override;
+  std::string GetFilename() override { return filename_; }
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,26 @@
+#!/bin/bash
+set -e
+
+# Smoke test on a file backed emulated zoned device, no zoned hardware needed.
+# The sparse device file and its <file>.zones sidecar are recreated.
+#
+# Example:
+#   ./zenfs_base_emulated.sh /tmp/zenfs-emu
+
+ZPATH=${1:-/tmp/zenfs-emu}
+ZONE_SIZE=${ZONE_SIZE:-64M}
+NR_ZONES=${NR_ZONES:-256}
+
+rm -f $ZPATH $ZPATH.zones
+export ZDEV="file:$ZPATH,zone_size=$ZONE_SIZE,nr_zones=$NR_ZONES,max_active_zones=14"
+
+FS_URI="zenfs://dev:file:$ZPATH"
+
+NAME="zenfs-emulated-baseline"
+echo "$(tput setaf 4)Running ZenFS tests on an emulated device, results will be stored in results/$NAME $(tput sgr 0)"
+
+# The utils set creates the file system
+FS_PARAMS="--fs_uri=$FS_URI" ./run.sh $NAME utils
+
+rm -rf /tmp/zenfs-aux && ../util/zenfs mkfs --zbd=$ZDEV --aux_path=/tmp/zenfs-aux --finish_threshold=5 --force
+FS_PARAMS="--fs_uri=$FS_URI" ./run.sh $NAME smoke
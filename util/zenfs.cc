@@ -46,6 +46,8 @@ DEFINE_string(restore_path, "", "Path to restore files");
 DEFINE_string(backup_path, "", "Path to backup files");
 DEFINE_string(src_file, "", "Source file path");
 DEFINE_string(dest_file, "", "Destination file path");
+DEFINE_int32(min_extents, 16,
+             "Defragment files with at least this many extents");
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -766,6 +768,69 @@ int zenfs_tool_fsinfo() {
   std::string superblock_report;
   zenFS->ReportSuperblock(&superblock_report);
   fprintf(stdout, "%s\n", superblock_report.c_str());
+  fprintf(stdout, "Usable Zone Capacity [Bytes]:\t%lu\n",
+          zenFS->GetUsableZoneCapacity());
+  return 0;
+}
+
+int zenfs_tool_set_finish_threshold() {
+  Status s;
+  IOStatus io_s;
+
+  if (FLAGS_finish_threshold < 0 || FLAGS_finish_threshold > 100) {
+    fprintf(stderr, "Error: Specify a --finish_threshold of 0-100.\n");
+    return 1;
+  }
+  std::unique_ptr<ZonedBlockDevice> zbd = zbd_open(false, true);
+  if (!zbd) return 1;
+
+  std::unique_ptr<ZenFS> zenFS;
+  s = zenfs_mount(zbd, &zenFS, false);
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to mount filesystem, error: %s\n",
+            s.ToString().c_str());
+    return 1;
+  }
+
+  io_s = zenFS->SetFinishThreshold(FLAGS_finish_threshold);
+  if (!io_s.ok()) {
+    fprintf(stderr, "Setting the finish threshold failed, error: %s\n",
+            io_s.ToString().c_str());
+    return 1;
+  }
+  fprintf(stdout, "Finish threshold set to %d%%\n", FLAGS_finish_threshold);
+
+  return 0;
+}
+
+int zenfs_tool_defrag() {
+  Status s;
+  IOStatus io_s;
+
+  if (FLAGS_min_extents < 2) {
+    fprintf(stderr, "Error: Specify --min_extents of at least 2.\n");
+    return 1;
+  }
+  std::unique_ptr<ZonedBlockDevice> zbd = zbd_open(false, true);
+  if (!zbd) return 1;
+
+  std::unique_ptr<ZenFS> zenFS;
+  s = zenfs_mount(zbd, &zenFS, false);
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to mount filesystem, error: %s\n",
+            s.ToString().c_str());
+    return 1;
+  }
+
+  io_s = zenFS->DefragmentFiles(FLAGS_min_extents);
+  if (!io_s.ok()) {
+    fprintf(stderr, "Defragmentation failed, error: %s\n",
+            io_s.ToString().c_str());
+    return 1;
+  }
+  fprintf(stdout, "Defragmented files with at least %d extents\n",
+          FLAGS_min_extents);
+
   return 0;
 }
 
@@ -775,12 +840,14 @@ int main(int argc, char **argv) {
   gflags::SetUsageMessage(
       std::string("\nUSAGE:\n") + argv[0] +
       +" <command> [OPTIONS]...\nCommands: mkfs, list, ls-uuid, " +
-      +"df, backup, restore, dump, fs-info, link, delete, rename, rmdir");
+      +"df, backup, restore, dump, fs-info, link, delete, rename, rmdir, " +
+      +"set-finish-threshold, defrag");
   if (argc < 2) {
     fprintf(stderr, "You need to specify a command:\n");
     fprintf(stderr,
             "\t./zenfs [list | ls-uuid | df | backup | restore | dump | "
-            "fs-info | link | delete | rename | rmdir]\n");
+            "fs-info | link | delete | rename | rmdir | "
+            "set-finish-threshold | defrag]\n");
     return 1;
   }
 
@@ -816,6 +883,10 @@ int main(int argc, char **argv) {
     return ROCKSDB_NAMESPACE::zenfs_tool_rename_file();
   } else if (subcmd == "rmdir") {
     return ROCKSDB_NAMESPACE::zenfs_tool_remove_directory();
+  } else if (subcmd == "set-finish-threshold") {
+    return ROCKSDB_NAMESPACE::zenfs_tool_set_finish_threshold();
+  } else if (subcmd == "defrag") {
+    return ROCKSDB_NAMESPACE::zenfs_tool_defrag();
   } else {
     fprintf(stderr, "Subcommand not recognized: %s\n", subcmd.c_str());
     return 1;
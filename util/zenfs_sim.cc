@@ -0,0 +1,413 @@
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+// Replays a file system trace against the ZenFS zone allocator on an
+// emulated zoned device, to compare allocation policies without hardware.
+//
+// Trace format, one operation per line, '#' starts a comment:
+//   create <file> <lifetime> [size hint]
+//   append <file> <bytes>
+//   sync <file>
+//   close <file>
+//   delete <file>
+// The lifetime is one of not_set, none, short, medium, long, extreme or the
+// numeric Env::WriteLifeTimeHint value.
+
+#include <gflags/gflags.h>
+#include <rocksdb/file_system.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef WITH_TERARKDB
+#include <fs/fs_zenfs.h>
+#include <fs/latency_zenfs.h>
+#include <fs/memzbd_zenfs.h>
+#include <fs/snapshot.h>
+#include <fs/version.h>
+#else
+#include <rocksdb/plugin/zenfs/fs/fs_zenfs.h>
+#include <rocksdb/plugin/zenfs/fs/latency_zenfs.h>
+#include <rocksdb/plugin/zenfs/fs/memzbd_zenfs.h>
+#include <rocksdb/plugin/zenfs/fs/snapshot.h>
+#include <rocksdb/plugin/zenfs/fs/version.h>
+#endif
+
+DEFINE_string(trace, "", "Trace file to replay");
+DEFINE_string(aux_path, "/tmp/zenfs_sim/",
+              "Path for auxiliary file storage (log and lock files).");
+DEFINE_uint64(zone_size, 256, "Emulated zone size in MB");
+DEFINE_uint64(zone_capacity, 0,
+              "Emulated writable zone capacity in MB, the zone size if 0");
+DEFINE_uint32(nr_zones, 128, "Number of emulated zones");
+DEFINE_uint32(block_size, 4096, "Emulated block size");
+DEFINE_uint32(max_active_zones, 14, "Emulated active zone limit, 0 for none");
+DEFINE_uint32(max_open_zones, 14, "Emulated open zone limit, 0 for none");
+DEFINE_bool(keep_data, false,
+            "Keep the data of all zones in memory, not only the metadata");
+DEFINE_string(latency_profile, "",
+              "Device latency profile, replay without device latencies if "
+              "empty");
+DEFINE_string(policy, "default", "Zone allocation policy");
+DEFINE_int32(finish_threshold, 0, "Finish used zones if less than x% left");
+DEFINE_uint32(gc_start_level, 0,
+              "Migrate data out of zones when free space drops below x%, "
+              "0 disables garbage collection");
+DEFINE_uint32(gc_threshold, 50,
+              "Minimum garbage percentage of a zone to migrate data out of it");
+DEFINE_uint64(report_interval, 100000,
+              "Print statistics every n trace operations, 0 for only at the "
+              "end");
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Counts zone token waits and timeouts, per zone IO class */
+struct SimMetrics : public ZenFSMetrics {
+  std::atomic<uint64_t> waits[ZONE_IO_CLASS_NR];
+  std::atomic<uint64_t> wait_us[ZONE_IO_CLASS_NR];
+  std::atomic<uint64_t> timeouts[ZONE_IO_CLASS_NR];
+
+  SimMetrics() {
+    for (int i = 0; i < ZONE_IO_CLASS_NR; i++) {
+      waits[i] = 0;
+      wait_us[i] = 0;
+      timeouts[i] = 0;
+    }
+  }
+
+  void AddReporter(uint32_t /*label*/, uint32_t /*type*/) override {}
+  void Report(uint32_t label, size_t value, uint32_t /*type*/) override {
+    if (label >= ZENFS_WAL_ZONE_TOKEN_WAIT_LATENCY &&
+        label <= ZENFS_GC_ZONE_TOKEN_WAIT_LATENCY) {
+      wait_us[label - ZENFS_WAL_ZONE_TOKEN_WAIT_LATENCY] += value;
+    } else if (label >= ZENFS_WAL_ZONE_TOKEN_WAIT_QPS &&
+               label <= ZENFS_GC_ZONE_TOKEN_WAIT_QPS) {
+      waits[label - ZENFS_WAL_ZONE_TOKEN_WAIT_QPS] += value;
+    } else if (label >= ZENFS_WAL_ZONE_TOKEN_TIMEOUT_QPS &&
+               label <= ZENFS_GC_ZONE_TOKEN_TIMEOUT_QPS) {
+      timeouts[label - ZENFS_WAL_ZONE_TOKEN_TIMEOUT_QPS] += value;
+    }
+  }
+  void ReportSnapshot(const ZenFSSnapshot& /*snapshot*/) override {}
+};
+
+static const char* io_class_names[ZONE_IO_CLASS_NR] = {
+    "wal", "flush", "shallow compaction", "deep compaction", "gc"};
+
+class ZenFSSim {
+  MemZonedBackend* dev_;
+  ZonedBlockDevice* zbd_;
+  std::unique_ptr<ZenFS> zenfs_;
+  std::shared_ptr<SimMetrics> metrics_;
+  std::map<std::string, std::unique_ptr<FSWritableFile>> files_;
+  std::string zeros_;
+
+  uint64_t ops_ = 0;
+  uint64_t appended_ = 0;
+  uint64_t gc_runs_ = 0;
+  uint64_t gc_migrated_ = 0;
+
+  IOStatus Create(const std::string& fname, Env::WriteLifeTimeHint lifetime,
+                  uint64_t size_hint);
+  IOStatus Append(const std::string& fname, uint64_t size);
+  IOStatus Sync(const std::string& fname);
+  IOStatus Close(const std::string& fname);
+  IOStatus Delete(const std::string& fname);
+  IOStatus GarbageCollect();
+
+ public:
+  ZenFSSim() : dev_(nullptr), zbd_(nullptr), zeros_(1 << 20, '\0') {}
+
+  Status Setup();
+  Status Replay(std::istream& trace);
+  void Report(const char* title);
+};
+
+Status ZenFSSim::Setup() {
+  MemZonedOptions options;
+  options.block_size = FLAGS_block_size;
+  options.zone_size = FLAGS_zone_size << 20;
+  options.zone_capacity = FLAGS_zone_capacity << 20;
+  options.nr_zones = FLAGS_nr_zones;
+  options.max_active_zones = FLAGS_max_active_zones;
+  options.max_open_zones = FLAGS_max_open_zones;
+  /* The metadata log lives in the first zones, the file data is not read
+   * back unless it is migrated, and then its content does not matter */
+  if (!FLAGS_keep_data) options.nr_stored_zones = 3;
+
+  dev_ = new MemZonedBackend(options);
+  std::unique_ptr<ZonedBlockDeviceBackend> backend(dev_);
+  if (!FLAGS_latency_profile.empty())
+    backend.reset(
+        new LatencyModelBackend(std::move(backend), FLAGS_latency_profile));
+
+  metrics_ = std::make_shared<SimMetrics>();
+  zbd_ = new ZonedBlockDevice(std::move(backend), nullptr, metrics_);
+  IOStatus ios = zbd_->Open(false, true);
+  if (!ios.ok()) {
+    delete zbd_;
+    return ios;
+  }
+
+  std::shared_ptr<FileSystem> aux_fs = FileSystem::Default();
+  IOStatus aux_s =
+      aux_fs->CreateDirIfMissing(FLAGS_aux_path, IOOptions(), nullptr);
+  if (!aux_s.ok()) {
+    delete zbd_;
+    return aux_s;
+  }
+  if (FLAGS_aux_path.back() != '/') FLAGS_aux_path.append("/");
+
+  zenfs_.reset(new ZenFS(zbd_, aux_fs, nullptr));
+  Status s = zenfs_->MkFS(FLAGS_aux_path, FLAGS_finish_threshold);
+  if (!s.ok()) return s;
+  s = zenfs_->Mount(false);
+  if (!s.ok()) return s;
+
+  return zenfs_->SetAllocationPolicy(FLAGS_policy);
+}
+
+static bool ParseLifetime(const std::string& str,
+                          Env::WriteLifeTimeHint* lifetime) {
+  static const char* names[] = {"not_set", "none", "short",
+                                "medium",  "long", "extreme"};
+
+  for (int i = 0; i <= Env::WLTH_EXTREME; i++) {
+    if (str == names[i] || str == std::to_string(i)) {
+      *lifetime = static_cast<Env::WriteLifeTimeHint>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+IOStatus ZenFSSim::Create(const std::string& fname,
+                          Env::WriteLifeTimeHint lifetime,
+                          uint64_t size_hint) {
+  std::unique_ptr<FSWritableFile> file;
+  FileOptions file_opts;
+
+  IOStatus s = zenfs_->NewWritableFile(fname, file_opts, &file, nullptr);
+  if (!s.ok()) return s;
+
+  file->SetWriteLifeTimeHint(lifetime);
+  if (size_hint) file->SetPreallocationBlockSize(size_hint);
+  files_[fname] = std::move(file);
+  return IOStatus::OK();
+}
+
+IOStatus ZenFSSim::Append(const std::string& fname, uint64_t size) {
+  auto it = files_.find(fname);
+  if (it == files_.end()) return IOStatus::NotFound("Not open: " + fname);
+
+  while (size) {
+    uint64_t n = std::min(size, (uint64_t)zeros_.size());
+    IOStatus s = it->second->Append(Slice(zeros_.data(), n), IOOptions(),
+                                    nullptr);
+    if (!s.ok()) return s;
+    size -= n;
+    appended_ += n;
+  }
+  return IOStatus::OK();
+}
+
+IOStatus ZenFSSim::Sync(const std::string& fname) {
+  auto it = files_.find(fname);
+  if (it == files_.end()) return IOStatus::NotFound("Not open: " + fname);
+  return it->second->Sync(IOOptions(), nullptr);
+}
+
+IOStatus ZenFSSim::Close(const std::string& fname) {
+  auto it = files_.find(fname);
+  if (it == files_.end()) return IOStatus::NotFound("Not open: " + fname);
+
+  IOStatus s = it->second->Close(IOOptions(), nullptr);
+  files_.erase(it);
+  return s;
+}
+
+IOStatus ZenFSSim::Delete(const std::string& fname) {
+  auto it = files_.find(fname);
+  if (it != files_.end()) {
+    it->second->Close(IOOptions(), nullptr);
+    files_.erase(it);
+  }
+  return zenfs_->DeleteFile(fname, IOOptions(), nullptr);
+}
+
+/* Migrate the valid data out of full zones with enough garbage, so that the
+ * zones can be reset */
+IOStatus ZenFSSim::GarbageCollect() {
+  uint64_t total = zbd_->GetFreeSpace() + zbd_->GetUsedSpace() +
+                   zbd_->GetReclaimableSpace();
+  if (total == 0 ||
+      zbd_->GetFreeSpace() * 100 / total >= FLAGS_gc_start_level)
+    return IOStatus::OK();
+
+  ZenFSSnapshot snapshot;
+  ZenFSSnapshotOptions options;
+  options.zone_ = 1;
+  options.zone_file_ = 1;
+  options.log_garbage_ = 1;
+  zenfs_->GetZenFSSnapshot(snapshot, options);
+
+  std::set<uint64_t> victims;
+  for (const auto& zone : snapshot.zones_) {
+    if (zone.capacity != 0 || zone.max_capacity == 0) continue;
+    uint64_t garbage_pct =
+        100 - 100 * zone.used_capacity / zone.max_capacity;
+    if (garbage_pct >= FLAGS_gc_threshold) victims.insert(zone.start);
+  }
+  if (victims.empty()) return IOStatus::OK();
+
+  std::vector<ZoneExtentSnapshot*> migrate_exts;
+  for (auto& ext : snapshot.extents_) {
+    if (victims.find(ext.zone_start) != victims.end()) {
+      migrate_exts.push_back(&ext);
+      gc_migrated_ += ext.length;
+    }
+  }
+
+  gc_runs_++;
+  return zenfs_->MigrateExtents(migrate_exts);
+}
+
+Status ZenFSSim::Replay(std::istream& trace) {
+  std::string line;
+  uint64_t line_nr = 0;
+
+  while (std::getline(trace, line)) {
+    line_nr++;
+    std::size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+
+    std::istringstream tokens(line);
+    std::string op, fname;
+    if (!(tokens >> op)) continue;
+    if (!(tokens >> fname))
+      return Status::InvalidArgument("Missing file name on line " +
+                                     std::to_string(line_nr));
+
+    IOStatus s;
+    if (op == "create") {
+      std::string lifetime_str;
+      Env::WriteLifeTimeHint lifetime = Env::WLTH_NOT_SET;
+      uint64_t size_hint = 0;
+      if ((tokens >> lifetime_str) && !ParseLifetime(lifetime_str, &lifetime))
+        return Status::InvalidArgument("Bad lifetime on line " +
+                                       std::to_string(line_nr));
+      tokens >> size_hint;
+      s = Create(fname, lifetime, size_hint);
+    } else if (op == "append") {
+      uint64_t size = 0;
+      if (!(tokens >> size))
+        return Status::InvalidArgument("Missing append size on line " +
+                                       std::to_string(line_nr));
+      s = Append(fname, size);
+    } else if (op == "sync") {
+      s = Sync(fname);
+    } else if (op == "close") {
+      s = Close(fname);
+    } else if (op == "delete") {
+      s = Delete(fname);
+    } else {
+      return Status::InvalidArgument("Unknown operation on line " +
+                                     std::to_string(line_nr));
+    }
+
+    if (!s.ok()) {
+      fprintf(stderr, "Line %lu: %s %s failed: %s\n", line_nr, op.c_str(),
+              fname.c_str(), s.ToString().c_str());
+      if (s.IsNoSpace()) return s;
+    }
+
+    ops_++;
+    if (FLAGS_gc_start_level) {
+      s = GarbageCollect();
+      if (!s.ok())
+        fprintf(stderr, "Garbage collection failed: %s\n",
+                s.ToString().c_str());
+    }
+    if (FLAGS_report_interval && ops_ % FLAGS_report_interval == 0)
+      Report("Progress");
+  }
+
+  for (auto& file : files_) file.second->Close(IOOptions(), nullptr);
+  files_.clear();
+
+  return Status::OK();
+}
+
+void ZenFSSim::Report(const char* title) {
+  uint64_t written = dev_->GetBytesWritten();
+
+  fprintf(stdout, "%s after %lu operations:\n", title, ops_);
+  fprintf(stdout, "  Appended: %lu MB, device writes: %lu MB, WA: %.3f\n",
+          appended_ >> 20, written >> 20,
+          appended_ ? (double)written / appended_ : 0.0);
+  fprintf(stdout, "  Zone resets: %lu, zone finishes: %lu\n",
+          dev_->GetResets(), dev_->GetFinishes());
+  fprintf(stdout, "  Space used: %lu MB, free: %lu MB, reclaimable: %lu MB\n",
+          zbd_->GetUsedSpace() >> 20, zbd_->GetFreeSpace() >> 20,
+          zbd_->GetReclaimableSpace() >> 20);
+  if (FLAGS_gc_start_level)
+    fprintf(stdout, "  GC runs: %lu, migrated: %lu MB\n", gc_runs_,
+            gc_migrated_ >> 20);
+  for (int i = 0; i < ZONE_IO_CLASS_NR; i++) {
+    if (!metrics_->waits[i] && !metrics_->timeouts[i]) continue;
+    fprintf(stdout,
+            "  Zone token stalls (%s): %lu, waited %lu us, timed out %lu\n",
+            io_class_names[i], metrics_->waits[i].load(),
+            metrics_->wait_us[i].load(), metrics_->timeouts[i].load());
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage(std::string("\nUSAGE:\n") + argv[0] +
+                          " --trace=<trace file> [OPTIONS]...");
+  gflags::SetVersionString(ZENFS_VERSION);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_trace.empty()) {
+    fprintf(stderr, "You need to specify a trace file using --trace\n");
+    return 1;
+  }
+
+  std::ifstream trace(FLAGS_trace);
+  if (!trace.is_open()) {
+    fprintf(stderr, "Failed to open trace file %s\n", FLAGS_trace.c_str());
+    return 1;
+  }
+
+  ROCKSDB_NAMESPACE::ZenFSSim sim;
+  ROCKSDB_NAMESPACE::Status s = sim.Setup();
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to set up the simulation: %s\n",
+            s.ToString().c_str());
+    return 1;
+  }
+
+  s = sim.Replay(trace);
+  sim.Report("Result");
+  if (!s.ok()) {
+    fprintf(stderr, "Replay stopped: %s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,5 +1,5 @@
-zenfs_SOURCES = fs/fs_zenfs.cc fs/zbd_zenfs.cc fs/io_zenfs.cc
-zenfs_HEADERS = fs/fs_zenfs.h fs/zbd_zenfs.h fs/io_zenfs.h fs/version.h fs/metrics.h fs/snapshot.h fs/filesystem_utility.h
+zenfs_SOURCES = fs/fs_zenfs.cc fs/zbd_zenfs.cc fs/io_zenfs.cc fs/reclaim_zenfs.cc fs/lifetime_zenfs.cc fs/scheduler_zenfs.cc fs/policy_zenfs.cc fs/backend_zenfs.cc fs/zbdlib_zenfs.cc fs/emuzbd_zenfs.cc fs/memzbd_zenfs.cc fs/filezbd_zenfs.cc fs/latency_zenfs.cc fs/bufpool_zenfs.cc
+zenfs_HEADERS = fs/fs_zenfs.h fs/zbd_zenfs.h fs/io_zenfs.h fs/version.h fs/metrics.h fs/snapshot.h fs/filesystem_utility.h fs/reclaim_zenfs.h fs/lifetime_zenfs.h fs/scheduler_zenfs.h fs/policy_zenfs.h fs/backend_zenfs.h fs/zbdlib_zenfs.h fs/emuzbd_zenfs.h fs/memzbd_zenfs.h fs/filezbd_zenfs.h fs/latency_zenfs.h fs/bufpool_zenfs.h
 zenfs_LDFLAGS = -u zenfs_filesystem_reg
 
 ZENFS_ROOT_DIR := $(shell dirname $(realpath $(lastword $(MAKEFILE_LIST))))